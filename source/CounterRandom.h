@@ -0,0 +1,83 @@
+#ifndef _COUNTER_RANDOM_H
+#define _COUNTER_RANDOM_H
+
+#include <cstdint>
+
+/// Counter-based random number stream (Philox4x32-10, from Salmon et al.
+/// 2011, "Parallel random numbers: as easy as 1, 2, 3"). Each number is a
+/// hash of a key and a counter rather than the next state of a shared
+/// generator, so a stream can be made for any (seed, update, cell, purpose)
+/// on the spot and always produces the same numbers, whichever thread asks
+/// and in whatever order. Draws match emp::Random's interface for the calls
+/// the model makes.
+class CounterRandom {
+    uint32_t key[2];
+    uint32_t counter[4];
+    uint32_t block[4];
+    int used = 4; // Words of block already handed out
+
+    static void MulHiLo(uint32_t a, uint32_t b, uint32_t & hi, uint32_t & lo) {
+        const uint64_t product = (uint64_t)a * b;
+        hi = (uint32_t)(product >> 32);
+        lo = (uint32_t)product;
+    }
+
+    public:
+    /// The ten Philox rounds, turning ctr into out under key k
+    static void Philox(const uint32_t ctr[4], const uint32_t k[2], uint32_t out[4]) {
+        uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+        uint32_t k0 = k[0], k1 = k[1];
+        for (int round = 0; round < 10; round++) {
+            uint32_t hi0, lo0, hi1, lo1;
+            MulHiLo(0xD2511F53u, c0, hi0, lo0);
+            MulHiLo(0xCD9E8D57u, c2, hi1, lo1);
+            c0 = hi1 ^ c1 ^ k0;
+            c1 = lo1;
+            c2 = hi0 ^ c3 ^ k1;
+            c3 = lo0;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+        out[0] = c0;
+        out[1] = c1;
+        out[2] = c2;
+        out[3] = c3;
+    }
+
+    /// The stream for seed and the three stream ids a, b and c
+    CounterRandom(uint64_t seed, uint32_t a, uint32_t b, uint32_t c)
+      : key{(uint32_t)seed, (uint32_t)(seed >> 32)}, counter{a, b, c, 0} {;}
+
+    uint32_t GetUInt() {
+        if (used == 4) {
+            Philox(counter, key, block);
+            counter[3]++;
+            used = 0;
+        }
+        return block[used++];
+    }
+
+    /// Uniform in [0, 1), with 53 random bits
+    double GetDouble() {
+        const uint64_t high = GetUInt() >> 5;
+        const uint64_t low = GetUInt() >> 6;
+        return (high * 67108864.0 + low) * (1.0 / 9007199254740992.0);
+    }
+
+    /// Uniform in [0, max), from a single 32-bit draw (so the four draws a
+    /// dividing cell makes all come from one block)
+    uint32_t GetUInt(uint32_t max) {
+        return (uint32_t)(((uint64_t)GetUInt() * max) >> 32);
+    }
+
+    uint32_t GetUInt(uint32_t min, uint32_t max) {
+        return min + GetUInt(max - min);
+    }
+
+    /// True with probability p (to within 2^-32), from a single 32-bit draw
+    bool P(double p) {
+        return GetUInt() < p * 4294967296.0;
+    }
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef _DIFFUSION_KERNELS_H
+#define _DIFFUSION_KERNELS_H
+
+#include <string>
+#include <utility>
+
+#include "base/vector.h"
+
+// Hand-vectorized kernels are only built where we can ask the CPU at runtime
+// which instruction sets it supports. Everywhere else (e.g. the Emscripten
+// build) only the portable kernel exists.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(__EMSCRIPTEN__)
+#define DIFFUSION_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define DIFFUSION_KERNELS_X86 0
+#endif
+
+// GCC contracts a*b+c into a fused multiply-add by default in C++ whenever the
+// target has FMA (which AVX-512 implies). That changes rounding, so keep it
+// off inside the kernels.
+#if defined(__GNUC__) && !defined(__clang__)
+#define DIFFUSION_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define DIFFUSION_NO_CONTRACT
+#endif
+
+namespace diffusion_kernels {
+
+    /// A row kernel applies the 7-point stencil (or the 5-point one, for
+    /// planar grids) to voxels [begin, end) of one x-row. c is the row being
+    /// updated, y_lo/y_hi/z_lo/z_hi are the rows that neighbor it (already
+    /// resolved for boundaries by the caller; planar kernels never read the z
+    /// rows), and results are written into next (overwriting whatever was
+    /// there). Voxels begin-1 and end must exist in c. T is how values are
+    /// stored.
+    template <typename T>
+    using row_kernel_fn = void (*)(T * next, const T * c,
+                                   const T * y_lo, const T * y_hi,
+                                   const T * z_lo, const T * z_hi,
+                                   size_t begin, size_t end, double coef);
+    using row_kernel_t = row_kernel_fn<double>;
+
+    // All kernels add the neighbors in the same order as
+    // ResourceGradient::GetNeighborOxygen (left, right, y-1, y+1, z-1, z+1)
+    // and never fuse multiply-adds, so every kernel gives bit-identical results.
+    // DIMS is 3, or 2 for grids with a single z-layer, where the z terms
+    // would only add and then subtract the center voxel twice. The center
+    // weight of the central difference is 2 per dimension. Values stored as
+    // T are widened to ACC for the arithmetic and rounded back when stored.
+
+    template <typename T, typename ACC, int DIMS>
+    DIFFUSION_NO_CONTRACT
+    inline void DiffuseRowScalar(T * __restrict next, const T * __restrict c,
+                                 const T * __restrict y_lo, const T * __restrict y_hi,
+                                 const T * __restrict z_lo, const T * __restrict z_hi,
+                                 size_t begin, size_t end, double coef) {
+        const ACC acc_coef = (ACC) coef;
+        for (size_t i = begin; i < end; i++) {
+            const ACC center = c[i];
+            ACC neighbors = (ACC) c[i-1] + (ACC) c[i+1] + (ACC) y_lo[i] + (ACC) y_hi[i];
+            if constexpr (DIMS == 3) {
+                neighbors = neighbors + (ACC) z_lo[i] + (ACC) z_hi[i];
+            }
+            next[i] = (T) (center + (acc_coef * (neighbors - ((ACC) (2 * DIMS) * center))));
+        }
+    }
+
+#if DIFFUSION_KERNELS_X86
+#define DIFFUSION_AVX2 __attribute__((target("avx2"), always_inline))
+#define DIFFUSION_AVX512 __attribute__((target("avx512f"), always_inline))
+
+    // Vector operations for each combination of storage and arithmetic
+    // type: doubles, floats, or floats widened to doubles (which halves how
+    // many voxels fit in a register)
+    template <typename T, typename ACC> struct AVX2Ops;
+
+    template <> struct AVX2Ops<double, double> {
+        using vec = __m256d;
+        static constexpr size_t WIDTH = 4;
+        DIFFUSION_AVX2 static vec Load(const double * p) {return _mm256_loadu_pd(p);}
+        DIFFUSION_AVX2 static void Store(double * p, vec v) {_mm256_storeu_pd(p, v);}
+        DIFFUSION_AVX2 static vec Set(double v) {return _mm256_set1_pd(v);}
+        DIFFUSION_AVX2 static vec Add(vec a, vec b) {return _mm256_add_pd(a, b);}
+        DIFFUSION_AVX2 static vec Sub(vec a, vec b) {return _mm256_sub_pd(a, b);}
+        DIFFUSION_AVX2 static vec Mul(vec a, vec b) {return _mm256_mul_pd(a, b);}
+    };
+
+    template <> struct AVX2Ops<float, float> {
+        using vec = __m256;
+        static constexpr size_t WIDTH = 8;
+        DIFFUSION_AVX2 static vec Load(const float * p) {return _mm256_loadu_ps(p);}
+        DIFFUSION_AVX2 static void Store(float * p, vec v) {_mm256_storeu_ps(p, v);}
+        DIFFUSION_AVX2 static vec Set(float v) {return _mm256_set1_ps(v);}
+        DIFFUSION_AVX2 static vec Add(vec a, vec b) {return _mm256_add_ps(a, b);}
+        DIFFUSION_AVX2 static vec Sub(vec a, vec b) {return _mm256_sub_ps(a, b);}
+        DIFFUSION_AVX2 static vec Mul(vec a, vec b) {return _mm256_mul_ps(a, b);}
+    };
+
+    template <> struct AVX2Ops<float, double> : AVX2Ops<double, double> {
+        DIFFUSION_AVX2 static vec Load(const float * p) {return _mm256_cvtps_pd(_mm_loadu_ps(p));}
+        DIFFUSION_AVX2 static void Store(float * p, vec v) {_mm_storeu_ps(p, _mm256_cvtpd_ps(v));}
+    };
+
+    template <typename T, typename ACC> struct AVX512Ops;
+
+    template <> struct AVX512Ops<double, double> {
+        using vec = __m512d;
+        static constexpr size_t WIDTH = 8;
+        DIFFUSION_AVX512 static vec Load(const double * p) {return _mm512_loadu_pd(p);}
+        DIFFUSION_AVX512 static void Store(double * p, vec v) {_mm512_storeu_pd(p, v);}
+        DIFFUSION_AVX512 static vec Set(double v) {return _mm512_set1_pd(v);}
+        DIFFUSION_AVX512 static vec Add(vec a, vec b) {return _mm512_add_pd(a, b);}
+        DIFFUSION_AVX512 static vec Sub(vec a, vec b) {return _mm512_sub_pd(a, b);}
+        DIFFUSION_AVX512 static vec Mul(vec a, vec b) {return _mm512_mul_pd(a, b);}
+    };
+
+    template <> struct AVX512Ops<float, float> {
+        using vec = __m512;
+        static constexpr size_t WIDTH = 16;
+        DIFFUSION_AVX512 static vec Load(const float * p) {return _mm512_loadu_ps(p);}
+        DIFFUSION_AVX512 static void Store(float * p, vec v) {_mm512_storeu_ps(p, v);}
+        DIFFUSION_AVX512 static vec Set(float v) {return _mm512_set1_ps(v);}
+        DIFFUSION_AVX512 static vec Add(vec a, vec b) {return _mm512_add_ps(a, b);}
+        DIFFUSION_AVX512 static vec Sub(vec a, vec b) {return _mm512_sub_ps(a, b);}
+        DIFFUSION_AVX512 static vec Mul(vec a, vec b) {return _mm512_mul_ps(a, b);}
+    };
+
+    // (The zero-masked conversions are the same instructions as the plain
+    // ones, without GCC warning about their undefined pass-through operand.)
+    template <> struct AVX512Ops<float, double> : AVX512Ops<double, double> {
+        DIFFUSION_AVX512 static vec Load(const float * p) {return _mm512_maskz_cvtps_pd(0xFF, _mm256_loadu_ps(p));}
+        DIFFUSION_AVX512 static void Store(float * p, vec v) {_mm256_storeu_ps(p, _mm512_maskz_cvtpd_ps(0xFF, v));}
+    };
+
+    template <typename T, typename ACC, int DIMS>
+    __attribute__((target("avx2"))) DIFFUSION_NO_CONTRACT
+    inline void DiffuseRowAVX2(T * __restrict next, const T * __restrict c,
+                               const T * __restrict y_lo, const T * __restrict y_hi,
+                               const T * __restrict z_lo, const T * __restrict z_hi,
+                               size_t begin, size_t end, double coef) {
+        using Ops = AVX2Ops<T, ACC>;
+        const typename Ops::vec v_coef = Ops::Set((ACC) coef);
+        const typename Ops::vec v_center = Ops::Set((ACC) (2 * DIMS));
+        size_t i = begin;
+        for (; i + Ops::WIDTH <= end; i += Ops::WIDTH) {
+            const typename Ops::vec center = Ops::Load(c + i);
+            typename Ops::vec neighbors = Ops::Add(Ops::Load(c + i - 1), Ops::Load(c + i + 1));
+            neighbors = Ops::Add(neighbors, Ops::Load(y_lo + i));
+            neighbors = Ops::Add(neighbors, Ops::Load(y_hi + i));
+            if constexpr (DIMS == 3) {
+                neighbors = Ops::Add(neighbors, Ops::Load(z_lo + i));
+                neighbors = Ops::Add(neighbors, Ops::Load(z_hi + i));
+            }
+            const typename Ops::vec laplacian = Ops::Sub(neighbors, Ops::Mul(v_center, center));
+            Ops::Store(next + i, Ops::Add(center, Ops::Mul(v_coef, laplacian)));
+        }
+        DiffuseRowScalar<T, ACC, DIMS>(next, c, y_lo, y_hi, z_lo, z_hi, i, end, coef);
+    }
+
+    template <typename T, typename ACC, int DIMS>
+    __attribute__((target("avx512f"))) DIFFUSION_NO_CONTRACT
+    inline void DiffuseRowAVX512(T * __restrict next, const T * __restrict c,
+                                 const T * __restrict y_lo, const T * __restrict y_hi,
+                                 const T * __restrict z_lo, const T * __restrict z_hi,
+                                 size_t begin, size_t end, double coef) {
+        using Ops = AVX512Ops<T, ACC>;
+        const typename Ops::vec v_coef = Ops::Set((ACC) coef);
+        const typename Ops::vec v_center = Ops::Set((ACC) (2 * DIMS));
+        size_t i = begin;
+        for (; i + Ops::WIDTH <= end; i += Ops::WIDTH) {
+            const typename Ops::vec center = Ops::Load(c + i);
+            typename Ops::vec neighbors = Ops::Add(Ops::Load(c + i - 1), Ops::Load(c + i + 1));
+            neighbors = Ops::Add(neighbors, Ops::Load(y_lo + i));
+            neighbors = Ops::Add(neighbors, Ops::Load(y_hi + i));
+            if constexpr (DIMS == 3) {
+                neighbors = Ops::Add(neighbors, Ops::Load(z_lo + i));
+                neighbors = Ops::Add(neighbors, Ops::Load(z_hi + i));
+            }
+            const typename Ops::vec laplacian = Ops::Sub(neighbors, Ops::Mul(v_center, center));
+            Ops::Store(next + i, Ops::Add(center, Ops::Mul(v_coef, laplacian)));
+        }
+        DiffuseRowScalar<T, ACC, DIMS>(next, c, y_lo, y_hi, z_lo, z_hi, i, end, coef);
+    }
+#endif
+
+    /// All kernels for dims (2 or 3) dimensions this CPU can run, fastest
+    /// last, storing T and computing in ACC.
+    template <typename T = double, typename ACC = T>
+    inline emp::vector<std::pair<std::string, row_kernel_fn<T> > > AvailableKernels(int dims = 3) {
+        emp::vector<std::pair<std::string, row_kernel_fn<T> > > kernels;
+        kernels.emplace_back("scalar", dims == 2 ? DiffuseRowScalar<T, ACC, 2> : DiffuseRowScalar<T, ACC, 3>);
+#if DIFFUSION_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            kernels.emplace_back("avx2", dims == 2 ? DiffuseRowAVX2<T, ACC, 2> : DiffuseRowAVX2<T, ACC, 3>);
+        }
+        if (__builtin_cpu_supports("avx512f")) {
+            kernels.emplace_back("avx512", dims == 2 ? DiffuseRowAVX512<T, ACC, 2> : DiffuseRowAVX512<T, ACC, 3>);
+        }
+#endif
+        return kernels;
+    }
+
+    /// Fastest kernel for dims dimensions supported by this CPU (checked once
+    /// per program run).
+    template <typename T = double, typename ACC = T>
+    inline row_kernel_fn<T> BestKernel(int dims = 3) {
+        static const row_kernel_fn<T> best_3d = AvailableKernels<T, ACC>(3).back().second;
+        static const row_kernel_fn<T> best_2d = AvailableKernels<T, ACC>(2).back().second;
+        return dims == 2 ? best_2d : best_3d;
+    }
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef _LOOKUP_TABLE_H
+#define _LOOKUP_TABLE_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+#include "base/vector.h"
+
+/// A smooth function of one variable, worked out at evenly spaced points
+/// over [min, max] and linearly interpolated in between, for functions that
+/// are expensive to evaluate and called a lot. Anything outside [min, max]
+/// goes to the function itself, so the table only has to cover the usual
+/// range of inputs. GetMaxError() bounds how far off interpolated values
+/// can be, for callers that need to know when to use the function instead.
+class LookupTable {
+    std::function<double(double)> fun;
+    double min_x;
+    double max_x;
+    double scale; // Table steps per unit of x
+    emp::vector<double> values;
+    double max_error = 0;
+
+    public:
+    /// points (at least 2) includes both ends of the range
+    LookupTable(std::function<double(double)> _fun, double min, double max, size_t points = 1025)
+      : fun(_fun), min_x(min), max_x(max) {
+        if (points < 2) {
+            points = 2;
+        }
+        scale = (points - 1) / (max_x - min_x);
+        values.resize(points);
+        for (size_t i = 0; i < points; i++) {
+            values[i] = fun(i + 1 < points ? min_x + i / scale : max_x);
+        }
+
+        // Interpolation is furthest off around the middle of each step, by
+        // about the same amount across a step for a smooth function; double
+        // the worst midpoint error to be safe, plus room for rounding
+        double worst = 0;
+        double largest = std::abs(values[0]);
+        for (size_t i = 0; i + 1 < points; i++) {
+            const double mid = min_x + (i + .5) / scale;
+            worst = std::max(worst, std::abs(fun(mid) - (*this)(mid)));
+            largest = std::max(largest, std::abs(values[i + 1]));
+        }
+        max_error = 2 * worst + 8 * std::numeric_limits<double>::epsilon() * largest;
+    }
+
+    double operator()(double x) const {
+        if (!(x >= min_x && x <= max_x)) { // Also catches NaN
+            return fun(x);
+        }
+        const double pos = (x - min_x) * scale;
+        size_t i = (size_t)pos;
+        if (i + 1 >= values.size()) {
+            i = values.size() - 2;
+        }
+        return values[i] + (values[i + 1] - values[i]) * (pos - i);
+    }
+
+    /// Most a value from the table can differ from the function by
+    double GetMaxError() const {
+        return max_error;
+    }
+
+    double GetMin() const {
+        return min_x;
+    }
+
+    double GetMax() const {
+        return max_x;
+    }
+
+    size_t GetNumPoints() const {
+        return values.size();
+    }
+};
+
+#endif
@@ -0,0 +1,503 @@
+#ifndef _MULTIGRID_H
+#define _MULTIGRID_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "base/vector.h"
+#include "ThreadPool.h"
+
+/// Geometric multigrid for the linear problem behind steady-state diffusion
+/// on a box of voxels:
+///
+///     k_i u_i - sum over axes of coef * (u_left + u_right - 2 u_i) = b_i
+///
+/// with no-flux (or periodic) edges, a non-negative sink coefficient k per
+/// voxel and pinned voxels that keep whatever value they have. Edges held
+/// at a fixed value can be expressed through k and b. Levels are
+/// cell-centered: each coarse voxel covers up to two fine voxels along every
+/// axis longer than one, residuals are averaged down and corrections are
+/// interpolated linearly back up. Red-black Gauss-Seidel is the smoother,
+/// the coarsest level is solved directly and each cycle is a W-cycle.
+class MultigridSolver {
+    public:
+    struct Level {
+        size_t nx = 0;
+        size_t ny = 0;
+        size_t nz = 0;
+        double coef[3] = {0, 0, 0};  // Coupling along x, y and z
+        emp::vector<double> u;       // Current solution (correction on coarse levels)
+        emp::vector<double> b;       // Right hand side
+        emp::vector<double> k;       // Sink coefficient
+        emp::vector<double> r;       // Residual scratch space
+        emp::vector<unsigned char> pinned;
+
+        // Filled in by Prepare()
+        emp::vector<double> pinned_coupling; // Coupling of each voxel to pinned neighbors
+        emp::vector<double> inv_children;    // 1 / number of unpinned fine voxels covered
+        emp::vector<double> zero_row;        // Stand-in for missing neighbor rows
+
+        size_t Size() const {return nx * ny * nz;}
+        size_t Len(size_t axis) const {return axis == 0 ? nx : (axis == 1 ? ny : nz);}
+    };
+
+    private:
+    emp::vector<Level> levels;
+    std::array<bool, 3> periodic = {{false, false, false}}; // Per axis
+    ThreadPool * pool = nullptr;
+    emp::vector<double> row_scratch;
+    emp::vector<double> dense;        // Coarsest level as a dense matrix, for SolveDirect()
+
+    static constexpr size_t PRE_SMOOTHING = 2;
+    static constexpr size_t POST_SMOOTHING = 2;
+    static constexpr size_t COARSEST_SWEEPS = 50;
+    static constexpr size_t COARSEST_SIZE = 64;
+    static constexpr size_t MIN_VOXELS_PER_THREAD = 8192;
+
+    size_t Wrap(size_t p, size_t n, bool up, size_t axis) const {
+        if (up) {
+            return p + 1 < n ? p + 1 : (periodic[axis] ? 0 : p);
+        }
+        return p > 0 ? p - 1 : (periodic[axis] ? n - 1 : p);
+    }
+
+    // Run fun(first_row, last_row) over the rows (y, z pairs) of a level.
+    // Voxels of one color only read the other color, so rows can be split
+    // between threads, except when wrapping around an odd-length axis puts
+    // two neighbors in the same color.
+    template <typename FUN>
+    void ForRows(const Level & level, const FUN & fun) const {
+        const size_t rows = level.ny * level.nz;
+        if (pool && !periodic[0] && !periodic[1] && !periodic[2] && level.Size() >= MIN_VOXELS_PER_THREAD * pool->GetNumThreads()) {
+            pool->ParallelFor(rows, [&fun](size_t begin, size_t end){fun(begin, end);});
+        } else {
+            fun(0, rows);
+        }
+    }
+
+    // The rows of u around row (y, z). Off the edge of the grid (without
+    // wrapping) the neighbor is missing: it points at zeros and its
+    // coupling is zero, so the same arithmetic works everywhere.
+    struct RowNeighbors {
+        const double * rows[4];  // y-1, y+1, z-1, z+1
+        double coupling[4];
+        double total_coupling;
+    };
+
+    RowNeighbors GetRowNeighbors(const Level & level, const emp::vector<double> & u, size_t y, size_t z) const {
+        RowNeighbors nb;
+        const size_t pos[2] = {y, z};
+        const size_t len[2] = {level.ny, level.nz};
+        nb.total_coupling = 0;
+        for (size_t axis = 0; axis < 2; axis++) {
+            for (size_t up = 0; up < 2; up++) {
+                const size_t other = Wrap(pos[axis], len[axis], up, axis + 1);
+                const size_t slot = axis * 2 + up;
+                if (other == pos[axis]) {
+                    nb.rows[slot] = level.zero_row.data();
+                    nb.coupling[slot] = 0;
+                } else {
+                    const size_t oy = axis == 0 ? other : y;
+                    const size_t oz = axis == 1 ? other : z;
+                    nb.rows[slot] = u.data() + level.nx * (oy + level.ny * oz);
+                    nb.coupling[slot] = level.coef[axis + 1];
+                }
+                nb.total_coupling += nb.coupling[slot];
+            }
+        }
+        return nb;
+    }
+
+    // Weighted sum of every neighbor of voxel x in row u (adding the
+    // couplings to diag)
+    double NeighborSum(const Level & level, const double * u, const RowNeighbors & nb, size_t x, double & diag) const {
+        if (x > 0 && x + 1 < level.nx) {
+            diag += nb.total_coupling + 2 * level.coef[0];
+            return level.coef[0] * (u[x - 1] + u[x + 1])
+                 + nb.coupling[0] * nb.rows[0][x] + nb.coupling[1] * nb.rows[1][x]
+                 + nb.coupling[2] * nb.rows[2][x] + nb.coupling[3] * nb.rows[3][x];
+        }
+        const size_t left = Wrap(x, level.nx, false, 0);
+        const size_t right = Wrap(x, level.nx, true, 0);
+        double total = nb.coupling[0] * nb.rows[0][x] + nb.coupling[1] * nb.rows[1][x]
+                     + nb.coupling[2] * nb.rows[2][x] + nb.coupling[3] * nb.rows[3][x];
+        diag += nb.total_coupling;
+        if (left != x) {
+            total += level.coef[0] * u[left];
+            diag += level.coef[0];
+        }
+        if (right != x) {
+            total += level.coef[0] * u[right];
+            diag += level.coef[0];
+        }
+        return total;
+    }
+
+    void Smooth(Level & level, size_t color) const {
+        ForRows(level, [&](size_t first_row, size_t last_row){
+            for (size_t row = first_row; row < last_row; row++) {
+                const size_t y = row % level.ny;
+                const size_t z = row / level.ny;
+                const RowNeighbors nb = GetRowNeighbors(level, level.u, y, z);
+                double * u = level.u.data() + row * level.nx;
+                const double * b = level.b.data() + row * level.nx;
+                const double * k = level.k.data() + row * level.nx;
+                const unsigned char * pinned = level.pinned.data() + row * level.nx;
+                for (size_t x = (y + z + color) % 2; x < level.nx; x += 2) {
+                    if (pinned[x]) {
+                        continue;
+                    }
+                    double diag = k[x];
+                    const double total = b[x] + NeighborSum(level, u, nb, x, diag);
+                    if (diag > 0) {
+                        u[x] = total / diag;
+                    }
+                }
+            }
+        });
+    }
+
+    void ComputeResidual(Level & level) const {
+        ForRows(level, [&](size_t first_row, size_t last_row){
+            for (size_t row = first_row; row < last_row; row++) {
+                const size_t y = row % level.ny;
+                const size_t z = row / level.ny;
+                const RowNeighbors nb = GetRowNeighbors(level, level.u, y, z);
+                const double * u = level.u.data() + row * level.nx;
+                const double * b = level.b.data() + row * level.nx;
+                const double * k = level.k.data() + row * level.nx;
+                const unsigned char * pinned = level.pinned.data() + row * level.nx;
+                double * r = level.r.data() + row * level.nx;
+                for (size_t x = 0; x < level.nx; x++) {
+                    if (pinned[x]) {
+                        r[x] = 0;
+                        continue;
+                    }
+                    double diag = k[x];
+                    const double total = NeighborSum(level, u, nb, x, diag);
+                    r[x] = b[x] + total - diag * u[x];
+                }
+            }
+        });
+    }
+
+    // Index of the coarse voxel covering fine voxel (x, y, z)
+    size_t CoarseIndex(const Level & fine, const Level & coarse, size_t x, size_t y, size_t z) const {
+        const size_t cx = coarse.nx < fine.nx ? x / 2 : x;
+        const size_t cy = coarse.ny < fine.ny ? y / 2 : y;
+        const size_t cz = coarse.nz < fine.nz ? z / 2 : z;
+        return cx + coarse.nx * (cy + coarse.ny * cz);
+    }
+
+    // Pinned voxels hold the error at zero, so on coarser levels the coupling
+    // to them acts like an extra sink. A coarse voxel is only pinned if
+    // every fine voxel it covers is.
+    void PrepareCoarse(const Level & fine, Level & coarse) const {
+        std::fill(coarse.pinned.begin(), coarse.pinned.end(), 1);
+        std::fill(coarse.inv_children.begin(), coarse.inv_children.end(), 0.0);
+        for (size_t z = 0; z < fine.nz; z++) {
+            for (size_t y = 0; y < fine.ny; y++) {
+                for (size_t x = 0; x < fine.nx; x++) {
+                    const size_t i = x + fine.nx * (y + fine.ny * z);
+                    if (!fine.pinned[i]) {
+                        const size_t ci = CoarseIndex(fine, coarse, x, y, z);
+                        coarse.pinned[ci] = 0;
+                        coarse.inv_children[ci]++;
+                    }
+                }
+            }
+        }
+        for (double & count : coarse.inv_children) {
+            count = count > 0 ? 1.0 / count : 0.0;
+        }
+    }
+
+    void PreparePinnedCoupling(Level & level) const {
+        std::fill(level.pinned_coupling.begin(), level.pinned_coupling.end(), 0.0);
+        const size_t stride[3] = {1, level.nx, level.nx * level.ny};
+        for (size_t z = 0; z < level.nz; z++) {
+            for (size_t y = 0; y < level.ny; y++) {
+                for (size_t x = 0; x < level.nx; x++) {
+                    const size_t i = x + level.nx * (y + level.ny * z);
+                    if (!level.pinned[i]) {
+                        continue;
+                    }
+                    const size_t pos[3] = {x, y, z};
+                    for (size_t axis = 0; axis < 3; axis++) {
+                        for (bool up : {false, true}) {
+                            const size_t other = Wrap(pos[axis], level.Len(axis), up, axis);
+                            if (other != pos[axis]) {
+                                level.pinned_coupling[i + other * stride[axis] - pos[axis] * stride[axis]] += level.coef[axis];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Average the fine residual and sinks of unpinned voxels into the
+    // coarse level
+    void Restrict(const Level & fine, Level & coarse) const {
+        std::fill(coarse.b.begin(), coarse.b.end(), 0.0);
+        std::fill(coarse.k.begin(), coarse.k.end(), 0.0);
+        const size_t shift = coarse.nx < fine.nx ? 1 : 0;
+        for (size_t z = 0; z < fine.nz; z++) {
+            for (size_t y = 0; y < fine.ny; y++) {
+                const size_t row = fine.nx * (y + fine.ny * z);
+                const size_t coarse_row = CoarseIndex(fine, coarse, 0, y, z);
+                for (size_t x = 0; x < fine.nx; x++) {
+                    const size_t i = row + x;
+                    if (fine.pinned[i]) {
+                        continue;
+                    }
+                    const size_t ci = coarse_row + (x >> shift);
+                    coarse.b[ci] += fine.r[i];
+                    coarse.k[ci] += fine.k[i] + fine.pinned_coupling[i];
+                }
+            }
+        }
+        for (size_t ci = 0; ci < coarse.Size(); ci++) {
+            coarse.b[ci] *= coarse.inv_children[ci];
+            coarse.k[ci] *= coarse.inv_children[ci];
+            coarse.u[ci] = 0;
+        }
+    }
+
+    // Fine voxels sit a quarter of a coarse voxel off the center of the
+    // coarse voxel covering them, so they take 3/4 of it and 1/4 of its
+    // neighbor on that side
+    void InterpolationWeights(size_t p, size_t fine_len, size_t coarse_len, size_t axis,
+                              size_t & near, size_t & far, double & far_weight) const {
+        if (coarse_len == fine_len) {
+            near = far = p;
+            far_weight = 0;
+            return;
+        }
+        near = p / 2;
+        far = Wrap(near, coarse_len, p % 2, axis);
+        far_weight = .25;
+    }
+
+    // Add the interpolated coarse correction to every unpinned fine voxel
+    void Prolongate(const Level & coarse, Level & fine) {
+        row_scratch.resize(coarse.nx);
+        for (size_t z = 0; z < fine.nz; z++) {
+            size_t z_near, z_far;
+            double z_weight;
+            InterpolationWeights(z, fine.nz, coarse.nz, 2, z_near, z_far, z_weight);
+            for (size_t y = 0; y < fine.ny; y++) {
+                size_t y_near, y_far;
+                double y_weight;
+                InterpolationWeights(y, fine.ny, coarse.ny, 1, y_near, y_far, y_weight);
+
+                // Blend the four coarse rows around this fine row in y and z...
+                auto coarse_row = [&](size_t cy, size_t cz){return coarse.u.data() + coarse.nx * (cy + coarse.ny * cz);};
+                const double * nn = coarse_row(y_near, z_near);
+                const double * fn = coarse_row(y_far, z_near);
+                const double * nf = coarse_row(y_near, z_far);
+                const double * ff = coarse_row(y_far, z_far);
+                for (size_t cx = 0; cx < coarse.nx; cx++) {
+                    row_scratch[cx] = (1 - z_weight) * ((1 - y_weight) * nn[cx] + y_weight * fn[cx])
+                                    + z_weight * ((1 - y_weight) * nf[cx] + y_weight * ff[cx]);
+                }
+
+                // ...and then along x
+                double * u = fine.u.data() + fine.nx * (y + fine.ny * z);
+                const unsigned char * pinned = fine.pinned.data() + fine.nx * (y + fine.ny * z);
+                for (size_t x = 0; x < fine.nx; x++) {
+                    if (pinned[x]) {
+                        continue;
+                    }
+                    size_t x_near, x_far;
+                    double x_weight;
+                    InterpolationWeights(x, fine.nx, coarse.nx, 0, x_near, x_far, x_weight);
+                    u[x] += (1 - x_weight) * row_scratch[x_near] + x_weight * row_scratch[x_far];
+                }
+            }
+        }
+    }
+
+    // Solve a (small) level exactly with Gaussian elimination. Sweeps barely
+    // touch the smoothest error when the sinks are weak, as they are in a
+    // long implicit time step, since only the sinks damp it. Returns false,
+    // leaving u alone, if the level is singular (no sinks and nothing
+    // pinned).
+    bool SolveDirect(Level & level) {
+        const size_t n = level.Size();
+        const size_t width = n + 1; // Each row holds its coefficients, then b
+        dense.assign(n * width, 0.0);
+        auto at = [&](size_t i, size_t j) -> double & {return dense[i * width + j];};
+        const size_t stride[3] = {1, level.nx, level.nx * level.ny};
+        double largest = 0;
+        for (size_t z = 0; z < level.nz; z++) {
+            for (size_t y = 0; y < level.ny; y++) {
+                for (size_t x = 0; x < level.nx; x++) {
+                    const size_t i = x + level.nx * (y + level.ny * z);
+                    if (level.pinned[i]) {
+                        at(i, i) = 1;
+                        at(i, n) = level.u[i];
+                        continue;
+                    }
+                    at(i, i) = level.k[i];
+                    at(i, n) = level.b[i];
+                    const size_t pos[3] = {x, y, z};
+                    for (size_t axis = 0; axis < 3; axis++) {
+                        for (bool up : {false, true}) {
+                            const size_t other = Wrap(pos[axis], level.Len(axis), up, axis);
+                            if (other != pos[axis]) {
+                                at(i, i) += level.coef[axis];
+                                at(i, i + other * stride[axis] - pos[axis] * stride[axis]) -= level.coef[axis];
+                            }
+                        }
+                    }
+                    largest = std::max(largest, at(i, i));
+                }
+            }
+        }
+
+        for (size_t col = 0; col < n; col++) {
+            size_t pivot = col;
+            for (size_t row = col + 1; row < n; row++) {
+                if (std::abs(at(row, col)) > std::abs(at(pivot, col))) {
+                    pivot = row;
+                }
+            }
+            if (!(std::abs(at(pivot, col)) > 1e-12 * largest)) {
+                return false;
+            }
+            if (pivot != col) {
+                std::swap_ranges(dense.begin() + pivot * width, dense.begin() + (pivot + 1) * width, dense.begin() + col * width);
+            }
+            for (size_t row = col + 1; row < n; row++) {
+                const double factor = at(row, col) / at(col, col);
+                if (factor != 0) {
+                    for (size_t j = col; j < width; j++) {
+                        at(row, j) -= factor * at(col, j);
+                    }
+                }
+            }
+        }
+        for (size_t i = n; i-- > 0; ) {
+            double total = at(i, n);
+            for (size_t j = i + 1; j < n; j++) {
+                total -= at(i, j) * level.u[j];
+            }
+            level.u[i] = total / at(i, i);
+        }
+        return true;
+    }
+
+    void Cycle(size_t depth) {
+        Level & level = levels[depth];
+        if (depth + 1 == levels.size()) {
+            if (level.Size() <= COARSEST_SIZE && SolveDirect(level)) {
+                return;
+            }
+            for (size_t sweep = 0; sweep < COARSEST_SWEEPS; sweep++) {
+                Smooth(level, 0);
+                Smooth(level, 1);
+            }
+            return;
+        }
+
+        for (size_t sweep = 0; sweep < PRE_SMOOTHING; sweep++) {
+            Smooth(level, 0);
+            Smooth(level, 1);
+        }
+        ComputeResidual(level);
+        Restrict(level, levels[depth + 1]);
+        // Visiting the coarse level twice (a W-cycle) makes up for how
+        // roughly pinned voxels are represented there
+        Cycle(depth + 1);
+        Cycle(depth + 1);
+        Prolongate(levels[depth + 1], level);
+        for (size_t sweep = 0; sweep < POST_SMOOTHING; sweep++) {
+            Smooth(level, 1);
+            Smooth(level, 0);
+        }
+    }
+
+    public:
+    /// Build the hierarchy for an nx by ny by nz grid where neighboring
+    /// voxels are coupled with strength coef, wrapping around along the
+    /// axes that are periodic. Keeps existing storage when the shape has
+    /// not changed.
+    void Setup(size_t nx, size_t ny, size_t nz, double coef, std::array<bool, 3> periodic_in, ThreadPool * pool_in) {
+        periodic = periodic_in;
+        pool = pool_in;
+        if (levels.size() == 0 || levels[0].nx != nx || levels[0].ny != ny || levels[0].nz != nz) {
+            levels.resize(0);
+            size_t dims[3] = {nx, ny, nz};
+            while (true) {
+                levels.emplace_back();
+                Level & level = levels.back();
+                level.nx = dims[0];
+                level.ny = dims[1];
+                level.nz = dims[2];
+                level.u.resize(level.Size(), 0.0);
+                level.b.resize(level.Size(), 0.0);
+                level.k.resize(level.Size(), 0.0);
+                level.r.resize(level.Size(), 0.0);
+                level.pinned.resize(level.Size(), 0);
+                level.pinned_coupling.resize(level.Size(), 0.0);
+                level.inv_children.resize(level.Size(), 0.0);
+                level.zero_row.resize(level.nx, 0.0);
+                if (level.Size() <= COARSEST_SIZE || std::max({dims[0], dims[1], dims[2]}) < 3) {
+                    break;
+                }
+                for (size_t & d : dims) {
+                    d = (d + 1) / 2;
+                }
+            }
+        }
+
+        // Doubling the spacing along an axis quarters the coupling along it
+        for (size_t depth = 0; depth < levels.size(); depth++) {
+            for (size_t axis = 0; axis < 3; axis++) {
+                if (depth == 0) {
+                    levels[0].coef[axis] = coef;
+                } else {
+                    const bool coarsened = levels[depth].Len(axis) < levels[depth - 1].Len(axis);
+                    levels[depth].coef[axis] = levels[depth - 1].coef[axis] / (coarsened ? 4.0 : 1.0);
+                }
+            }
+        }
+    }
+
+    /// The finest level, where callers fill in u, b, k and pinned
+    Level & Fine() {
+        return levels[0];
+    }
+
+    size_t GetNumLevels() const {
+        return levels.size();
+    }
+
+    /// Work out how pinned voxels carry over to coarser levels; call after
+    /// changing which fine voxels are pinned
+    void Prepare() {
+        for (size_t depth = 0; depth + 1 < levels.size(); depth++) {
+            PreparePinnedCoupling(levels[depth]);
+            PrepareCoarse(levels[depth], levels[depth + 1]);
+        }
+    }
+
+    /// Largest absolute residual of the fine level's equations
+    double MaxResidual() {
+        ComputeResidual(levels[0]);
+        double largest = 0;
+        for (double r : levels[0].r) {
+            largest = std::max(largest, std::abs(r));
+        }
+        return largest;
+    }
+
+    /// Improve the fine level's solution with one multigrid cycle
+    void Cycle() {
+        Cycle(0);
+    }
+};
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef _OBJECT_POOL_H
+#define _OBJECT_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+#include "base/vector.h"
+
+/// Free-list allocator for objects of one type, for types that are created
+/// and destroyed in large numbers (every cell in the population is replaced
+/// each update). Freed slots are kept on a per-thread list and handed out
+/// again, so steady-state churn never reaches malloc. Slots move between
+/// threads in batches through a shared list, so memory freed on one thread
+/// can be reused by another.
+///
+/// Memory is taken in batches of BATCH slots and never returned to the
+/// system. That keeps objects that outlive the pool (e.g. in static
+/// containers) safe to destroy during shutdown.
+template <typename T, size_t BATCH = 1024>
+class ObjectPool {
+    union Slot {
+        Slot * next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    struct Shared {
+        std::mutex mutex;
+        emp::vector<Slot *> batches; // Lists of exactly BATCH free slots
+        std::atomic<size_t> capacity{0};
+        std::atomic<size_t> live{0};
+    };
+
+    struct LocalList {
+        Slot * head = nullptr;
+        size_t count = 0;
+    };
+
+    static Shared & GetShared() {
+        static Shared & shared = *new Shared; // Deliberately never destroyed
+        return shared;
+    }
+
+    static LocalList & GetLocal() {
+        thread_local LocalList local;
+        return local;
+    }
+
+    /// Refill an empty local list from the shared one, or with fresh memory
+    static void Refill(LocalList & local) {
+        Shared & shared = GetShared();
+        {
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            if (shared.batches.size()) {
+                local.head = shared.batches.back();
+                local.count = BATCH;
+                shared.batches.pop_back();
+                return;
+            }
+        }
+        Slot * batch = static_cast<Slot *>(::operator new(sizeof(Slot) * BATCH));
+        for (size_t i = 0; i + 1 < BATCH; i++) {
+            batch[i].next = batch + i + 1;
+        }
+        batch[BATCH - 1].next = nullptr;
+        local.head = batch;
+        local.count = BATCH;
+        shared.capacity += BATCH;
+    }
+
+    /// Hand a batch of slots from a long local list to the shared one
+    static void Spill(LocalList & local) {
+        Slot * batch = local.head;
+        Slot * last = batch;
+        for (size_t i = 1; i < BATCH; i++) {
+            last = last->next;
+        }
+        local.head = last->next;
+        local.count -= BATCH;
+        last->next = nullptr;
+
+        Shared & shared = GetShared();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        shared.batches.push_back(batch);
+    }
+
+    public:
+    /// Memory for one T (not constructed)
+    static void * Allocate() {
+        LocalList & local = GetLocal();
+        if (!local.head) {
+            Refill(local);
+        }
+        Slot * slot = local.head;
+        local.head = slot->next;
+        local.count--;
+        GetShared().live.fetch_add(1, std::memory_order_relaxed);
+        return slot;
+    }
+
+    /// Give back memory from Allocate() (after the object is destroyed)
+    static void Release(void * ptr) {
+        LocalList & local = GetLocal();
+        Slot * slot = static_cast<Slot *>(ptr);
+        slot->next = local.head;
+        local.head = slot;
+        local.count++;
+        GetShared().live.fetch_sub(1, std::memory_order_relaxed);
+        if (local.count >= 2 * BATCH) {
+            Spill(local);
+        }
+    }
+
+    /// Objects currently allocated from the pool
+    static size_t GetLive() {
+        return GetShared().live.load(std::memory_order_relaxed);
+    }
+
+    /// Slots the pool has taken from the system, in use or not
+    static size_t GetCapacity() {
+        return GetShared().capacity.load(std::memory_order_relaxed);
+    }
+
+    /// Slots ready to be reused without asking the system for more memory
+    static size_t GetFree() {
+        return GetCapacity() - GetLive();
+    }
+};
+
+#endif
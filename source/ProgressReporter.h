@@ -0,0 +1,156 @@
+#ifndef _PROGRESS_REPORTER_H
+#define _PROGRESS_REPORTER_H
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "base/vector.h"
+
+/// Prints a line of progress every few updates. Lines are built from a
+/// format string, where these fields are filled in:
+///   {update}  updates done so far
+///   {total}   updates the run will take
+///   {rate}    updates per second since the last report
+///   {eta}     seconds left at that rate
+///   {pop}     population size
+///   {phases}  time spent in each phase since the last report
+/// Lines end with '\n' rather than std::endl, so reporting doesn't force a
+/// flush (which is slow when output goes to a network file system).
+class ProgressReporter {
+    public:
+    using clock_type = std::chrono::steady_clock;
+
+    private:
+    int interval = 0;
+    std::string format;
+    std::ostream * out;
+    size_t total = 0;
+
+    clock_type::time_point last_time;
+    size_t last_update = 0;
+    emp::vector<std::pair<std::string, double>> phases; // Seconds since the last report
+
+    static std::string Fixed(double value) {
+        std::ostringstream stream;
+        stream << std::fixed << std::setprecision(2) << value;
+        return stream.str();
+    }
+
+    public:
+    static constexpr const char * DEFAULT_FORMAT = "Update {update}/{total}: {rate} updates/s, ETA {eta}s, {pop} cells ({phases})";
+
+    /// interval of 0 means never report
+    ProgressReporter(int _interval = 0, const std::string & _format = DEFAULT_FORMAT, std::ostream & _out = std::cout)
+      : interval(_interval), format(_format), out(&_out) {
+        Start(0);
+    }
+
+    void SetInterval(int _interval) {
+        interval = _interval;
+    }
+
+    void SetFormat(const std::string & _format) {
+        format = _format;
+    }
+
+    void SetOutput(std::ostream & _out) {
+        out = &_out;
+    }
+
+    bool IsActive() const {
+        return interval > 0;
+    }
+
+    /// Start timing a run that will take total updates
+    void Start(size_t _total, size_t first_update = 0) {
+        total = _total;
+        last_update = first_update;
+        last_time = clock_type::now();
+        for (auto & phase : phases) {
+            phase.second = 0;
+        }
+    }
+
+    /// When a phase starts, to pass to EndPhase
+    clock_type::time_point StartPhase() const {
+        return IsActive() ? clock_type::now() : clock_type::time_point();
+    }
+
+    /// Count the time since start towards a phase (e.g. diffusion)
+    void EndPhase(const std::string & name, clock_type::time_point start) {
+        if (IsActive()) {
+            AddPhaseTime(name, std::chrono::duration<double>(clock_type::now() - start).count());
+        }
+    }
+
+    /// Count seconds spent in a phase towards the next report
+    void AddPhaseTime(const std::string & name, double seconds) {
+        for (auto & phase : phases) {
+            if (phase.first == name) {
+                phase.second += seconds;
+                return;
+            }
+        }
+        phases.emplace_back(name, seconds);
+    }
+
+    /// Call once per update; prints a line every interval updates
+    void Update(size_t update, size_t pop_size) {
+        if (!IsActive() || update % (size_t)interval != 0) {
+            return;
+        }
+
+        const clock_type::time_point now = clock_type::now();
+        const double seconds = std::chrono::duration<double>(now - last_time).count();
+        const double rate = seconds > 0 ? (update - last_update) / seconds : 0;
+        const double eta = rate > 0 && total > update ? (total - update) / rate : 0;
+
+        std::string phase_text;
+        for (auto & phase : phases) {
+            if (phase_text.size()) {
+                phase_text += ", ";
+            }
+            phase_text += phase.first + " " + Fixed(phase.second) + "s";
+            phase.second = 0;
+        }
+
+        std::string line;
+        size_t pos = 0;
+        while (pos < format.size()) {
+            const size_t open = format.find('{', pos);
+            const size_t close = open == std::string::npos ? open : format.find('}', open);
+            if (close == std::string::npos) {
+                line += format.substr(pos);
+                break;
+            }
+            line += format.substr(pos, open - pos);
+            const std::string field = format.substr(open + 1, close - open - 1);
+            if (field == "update") {
+                line += std::to_string(update);
+            } else if (field == "total") {
+                line += std::to_string(total);
+            } else if (field == "rate") {
+                line += Fixed(rate);
+            } else if (field == "eta") {
+                line += Fixed(eta);
+            } else if (field == "pop") {
+                line += std::to_string(pop_size);
+            } else if (field == "phases") {
+                line += phase_text;
+            } else {
+                line += format.substr(open, close - open + 1); // Leave unknown fields alone
+            }
+            pos = close + 1;
+        }
+        *out << line << '\n';
+
+        last_time = now;
+        last_update = update;
+    }
+};
+
+#endif
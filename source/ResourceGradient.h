@@ -1,85 +1,224 @@
 #ifndef _RESOURCE_GRADIENT_H
 #define _RESOURCE_GRADIENT_H
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <new>
+#include <utility>
+
 #include "base/vector.h"
+#include "DiffusionKernels.h"
+#include "Multigrid.h"
+#include "ThreadPool.h"
+
+/// Allocator handing out storage aligned to ALIGN bytes (a cache line by
+/// default), so that grid buffers start on a vector-register boundary.
+template <typename T, size_t ALIGN = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, ALIGN>;
+    };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, ALIGN> &) {;}
+
+    T * allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(ALIGN)));
+    }
 
-class ResourceGradient {
-    using grid_t = emp::vector<emp::vector<emp::vector<double> > >; // It might be possible to make these arrays
-    grid_t curr_grid;
-    grid_t next_grid;
+    void deallocate(T * p, size_t) {
+        ::operator delete(p, std::align_val_t(ALIGN));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, ALIGN> &) const {return true;}
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, ALIGN> &) const {return false;}
+};
+
+/// Oxygen (or any other resource) spreading over a 3D grid of voxels.
+/// Values are stored as T; stencil arithmetic is done in ACC, so
+/// ResourceGradientT<float, double> halves the memory traffic of the double
+/// version while still accumulating each Laplacian in double precision.
+/// Everything else (uptake, solvers, the public interface) works in double.
+template <typename T = double, typename ACC = T>
+class ResourceGradientT {
+    public:
+    /// What lies past a face of the grid: a mirror of the voxels on the face
+    /// (no flux through it), the opposite face (periodic) or a fixed value
+    /// (Dirichlet)
+    enum class Boundary {NO_FLUX, PERIODIC, DIRICHLET};
+    enum Face {X_LOW, X_HIGH, Y_LOW, Y_HIGH, Z_LOW, Z_HIGH};
+
+    private:
+    using grid_t = emp::vector<emp::vector<emp::vector<double> > >; // Nested layout, only used for importing grids
+    using buffer_t = emp::vector<T, AlignedAllocator<T> >;
+    using row_kernel_t = diffusion_kernels::row_kernel_fn<T>;
+
+    // Both grids are stored as single contiguous buffers in z/y/x order
+    // (x varies fastest), so voxel (x,y,z) lives at x + y*y_stride + z*z_stride.
+    buffer_t curr_grid;
+    buffer_t next_grid;
     double diffusion_coefficient;
     size_t x_len;
     size_t y_len;
     size_t z_len;
-    bool toroidal;
+    size_t y_stride;
+    size_t z_stride;
+
+    // Boundary policy of each face, indexed by Face. Policies are resolved
+    // once per row, by picking which rows stand in for neighbors off the
+    // edge, so the stencil kernels never branch on them.
+    Boundary boundary[6] = {Boundary::NO_FLUX, Boundary::NO_FLUX, Boundary::NO_FLUX,
+                            Boundary::NO_FLUX, Boundary::NO_FLUX, Boundary::NO_FLUX};
+    double boundary_value[6] = {0, 0, 0, 0, 0, 0};
+    emp::vector<T> ghost_rows[6];            // A row of boundary_value for each Dirichlet face
+    row_kernel_t row_kernel = diffusion_kernels::BestKernel<T, ACC>(3);
+    row_kernel_t planar_row_kernel = diffusion_kernels::BestKernel<T, ACC>(2);
+    std::shared_ptr<ThreadPool> pool; // Shared between copies; null means run serially
+
+    // What happens in each Step() besides diffusion: Michaelis-Menten uptake
+    // in flagged voxels and x-rows held at a fixed value (Dirichlet sources)
+    emp::vector<unsigned char> uptake_mask;  // One flag per voxel, empty until first used
+    emp::vector<size_t> uptake_row_count;    // Flagged voxels per row, so empty rows can be skipped
+    double uptake_rate = 0;
+    double uptake_km = 0;
+    emp::vector<double> source_rows;         // Value per row; NaN for rows that are not sources
+
+    // Changes queued for the next step with SetNextVal/DecNextVal. They are
+    // kept apart from next_grid so that stepping can overwrite next_grid
+    // instead of adding to it, and next_grid never has to be cleared.
+    buffer_t staged;                         // Empty until first used
+    emp::vector<unsigned char> staged_rows;  // Whether each row has anything staged
+    emp::vector<size_t> staged_voxels;       // Voxels to reset once applied (may repeat)
+    bool next_written = false;               // Whether Diffuse() has filled next_grid
+
+    MultigridSolver steady_state_solver;     // Kept between solves to reuse its storage
+    emp::vector<double> implicit_old;        // Values before a StepImplicit(), likewise
+    double steady_state_residual = 0;
+
+    // How much the last Update() moved the grid
+    struct Change {
+        double max = 0;
+        double sum_sq = 0;
+        void Add(const Change & other) {
+            max = std::max(max, other.max);
+            sum_sq += other.sum_sq;
+        }
+    };
+    Change last_change;
+
+    // Below this many voxels per thread, waking the pool costs more than it saves
+    static constexpr size_t MIN_VOXELS_PER_THREAD = 8192;
+
+    size_t Index(size_t x, size_t y, size_t z) const {
+        return x + y * y_stride + z * z_stride;
+    }
+
+    bool UsePool() const {
+        return pool && curr_grid.size() >= MIN_VOXELS_PER_THREAD * pool->GetNumThreads();
+    }
 
     public:
-    ResourceGradient(size_t x_len_in, size_t y_len_in=1, size_t z_len_in=1) :
+    ResourceGradientT(size_t x_len_in, size_t y_len_in=1, size_t z_len_in=1) :
         diffusion_coefficient(0),
         x_len(x_len_in), y_len(y_len_in), z_len(z_len_in),
-        toroidal(false) {
-        curr_grid.resize(z_len);
-        next_grid.resize(z_len);
-
-        for (size_t z = 0; z < z_len; z++) {
-            curr_grid[z].resize(y_len);
-            next_grid[z].resize(y_len);
-            for (size_t y = 0; y < y_len; y++) {
-                curr_grid[z][y].resize(x_len);
-                next_grid[z][y].resize(x_len);
-                for (size_t x = 0; x < x_len; x++) {
-                    curr_grid[z][y][x] = 0;
-                    next_grid[z][y][x] = 0;
-                }
-            }
-        }
+        y_stride(x_len_in), z_stride(x_len_in * y_len_in) {
+        curr_grid.resize(z_stride * z_len, 0);
+        next_grid.resize(z_stride * z_len, 0);
     }
 
-    ResourceGradient(const grid_t & g) {
-        x_len = g[0][0].size();        
-        y_len = g[0].size();
-        z_len = g.size();        
-
-        curr_grid.resize(z_len);
-        next_grid.resize(z_len);
+    ResourceGradientT(const grid_t & g) :
+        diffusion_coefficient(0),
+        x_len(g[0][0].size()), y_len(g[0].size()), z_len(g.size()),
+        y_stride(x_len), z_stride(x_len * y_len) {
+        curr_grid.resize(z_stride * z_len, 0);
+        next_grid.resize(z_stride * z_len, 0);
 
         for (size_t z = 0; z < z_len; z++) {
-            curr_grid[z].resize(y_len);
-            next_grid[z].resize(y_len);
             for (size_t y = 0; y < y_len; y++) {
-                curr_grid[z][y].resize(x_len);
-                next_grid[z][y].resize(x_len);
                 for (size_t x = 0; x < x_len; x++) {
-                    curr_grid[z][y][x] = g[z][y][x];
-                    next_grid[z][y][x] = 0;
+                    curr_grid[Index(x, y, z)] = g[z][y][x];
                 }
             }
         }
     }
 
     void SetVal(size_t x, size_t y, size_t z, double val) {
-        curr_grid[z][y][x] = val;
+        curr_grid[Index(x, y, z)] = val;
     }
 
     void SetNextVal(size_t x, size_t y, size_t z, double val) {
-        next_grid[z][y][x] = val;
+        NextVal(Index(x, y, z)) = val;
     }
 
     void DecVal(size_t x, size_t y, size_t z, double val) {
-        curr_grid[z][y][x] -= val;
+        curr_grid[Index(x, y, z)] -= val;
     }
 
     void DecNextVal(size_t x, size_t y, size_t z, double val) {
-        next_grid[z][y][x] -= val;
+        NextVal(Index(x, y, z)) -= val;
     }
 
     double GetVal(size_t x, size_t y, size_t z=0) const {
-        return curr_grid[z][y][x];
-    } 
+        return curr_grid[Index(x, y, z)];
+    }
+
+    /// Mark every voxel of layers [z, z + num_layers) holding less than
+    /// threshold: bit x + y * x_len + (layer - z) * x_len * y_len of below
+    /// (64 voxels to a word) is set if GetVal(x, y, layer) < threshold. One
+    /// streaming pass over the layers, for callers that would otherwise look
+    /// voxels up one at a time.
+    void FindBelow(double threshold, emp::vector<uint64_t> & below, size_t z = 0, size_t num_layers = 1) const {
+        const size_t layer_size = z_stride * num_layers;
+        const T * layer = curr_grid.data() + z * z_stride;
+        below.resize((layer_size + 63) / 64);
+        const size_t full_words = layer_size / 64;
+        for (size_t word = 0; word < full_words; word++) {
+            const T * vals = layer + word * 64;
+            uint64_t bits = 0;
+            for (size_t i = 0; i < 64; i++) {
+                bits |= (uint64_t)((double)vals[i] < threshold) << i;
+            }
+            below[word] = bits;
+        }
+        if (full_words < below.size()) {
+            uint64_t bits = 0;
+            for (size_t i = full_words * 64; i < layer_size; i++) {
+                bits |= (uint64_t)((double)layer[i] < threshold) << (i % 64);
+            }
+            below[full_words] = bits;
+        }
+    }
 
+    /// What the voxel will start the next step from: everything staged with
+    /// SetNextVal/DecNextVal, plus diffusion once Diffuse() has run
     double GetNextVal(size_t x, size_t y, size_t z = 0) const {
-        return next_grid[z][y][x];
-    } 
+        const size_t i = Index(x, y, z);
+        if (next_written) {
+            return next_grid[i];
+        }
+        return staged.size() ? staged[i] : 0.0;
+    }
+
+    size_t GetXLen() const {
+        return x_len;
+    }
+
+    size_t GetYLen() const {
+        return y_len;
+    }
+
+    size_t GetZLen() const {
+        return z_len;
+    }
 
     void SetDiffusionCoefficient(double coef) {
         diffusion_coefficient = coef;
@@ -89,154 +228,680 @@ class ResourceGradient {
         return diffusion_coefficient;
     }
 
+    /// Make every face periodic (or no-flux)
     void SetToroidal(bool tor) {
-        toroidal = tor;
+        for (size_t face = 0; face < 6; face++) {
+            SetBoundary((Face) face, tor ? Boundary::PERIODIC : Boundary::NO_FLUX);
+        }
     }
 
-    void Update() {
-        std::swap(curr_grid, next_grid);
-        for (size_t z = 0; z < z_len; z++) {
-            for (size_t y = 0; y < y_len; y++) {
-                for (size_t x = 0; x < x_len; x++) {
-                    // zero out new next grid
-                    next_grid[z][y][x] = 0;
+    /// Set what lies past one face of the grid (value is only used by
+    /// Dirichlet faces). Periodic faces only make sense in pairs, so making a
+    /// face periodic, or no longer periodic, changes the opposite face too.
+    void SetBoundary(Face face, Boundary type, double value = 0) {
+        const size_t opposite = face ^ 1;
+        if (type == Boundary::PERIODIC) {
+            boundary[opposite] = Boundary::PERIODIC;
+        } else if (boundary[opposite] == Boundary::PERIODIC) {
+            boundary[opposite] = Boundary::NO_FLUX;
+        }
+        boundary[face] = type;
+        boundary_value[face] = value;
+        ghost_rows[face].assign(type == Boundary::DIRICHLET ? x_len : 0, value);
+    }
 
-                    // Make sure there are no negative numbers in the
-                    // new curr_grid
-                    if (curr_grid[z][y][x] < 0) {
-                        curr_grid[z][y][x] = 0;
-                    }
-                }
-            }
-        }        
+    Boundary GetBoundary(Face face) const {
+        return boundary[face];
     }
 
-    double GetNeighborOxygen(size_t x, size_t y, size_t z) {
-        double total = 0;
+    double GetBoundaryValue(Face face) const {
+        return boundary_value[face];
+    }
 
-        if (toroidal) {
-            // Handle left
-            if (x <= 0) {
-                // Wrap around if toroidal and on left edge
-                total += curr_grid[z][y][x_len-1];
-            } else {
-                // Otherwise no adjustment is needed
-                total += curr_grid[z][y][x-1];
-            }
+    /// Override the automatically selected row kernel (e.g. to compare
+    /// instruction sets)
+    void SetRowKernel(row_kernel_t kernel) {
+        row_kernel = kernel;
+    }
 
-            // Handle right
-            if (x + 1 >= x_len) {
-                // Wrap around if toroidal and on right edge
-                total += curr_grid[z][y][0];
-            } else {
-                total += curr_grid[z][y][x+1];
-            }
+    /// Same for the 5-point kernel used on planar grids (see IsPlanar)
+    void SetPlanarRowKernel(row_kernel_t kernel) {
+        planar_row_kernel = kernel;
+    }
 
-            // Handle top
-            if (y <= 0) {
-                // Wrap around if toroidal and on top edge
-                total += curr_grid[z][y_len-1][x];
-            } else {
-                // Otherwise no adjustment is needed
-                total += curr_grid[z][y-1][x];
+    /// A grid with a single z-layer and no fixed values above or below it
+    /// has nothing moving along z, so it is diffused with the 2D stencil
+    bool IsPlanar() const {
+        return z_len == 1 && boundary[Z_LOW] != Boundary::DIRICHLET && boundary[Z_HIGH] != Boundary::DIRICHLET;
+    }
+
+    /// Split Diffuse and Update across num_threads threads (0 means one per
+    /// core). Each thread gets a contiguous slab of the grid and every voxel
+    /// is computed exactly as in the serial path, so results are identical.
+    void SetThreads(size_t num_threads) {
+        if (num_threads == 1) {
+            pool = nullptr;
+        } else {
+            pool = std::make_shared<ThreadPool>(num_threads);
+        }
+    }
+
+    size_t GetThreads() const {
+        return pool ? pool->GetNumThreads() : 1;
+    }
+
+    /// Every voxel flagged with SetUptake loses rate * c / (c + km) of
+    /// oxygen c per Step()
+    void SetUptakeKinetics(double rate, double km) {
+        uptake_rate = rate;
+        uptake_km = km;
+    }
+
+    void SetUptake(size_t x, size_t y, size_t z, bool consumes) {
+        if (uptake_mask.size() == 0) {
+            uptake_mask.resize(curr_grid.size(), 0);
+            uptake_row_count.resize(y_len * z_len, 0);
+        }
+        const size_t i = Index(x, y, z);
+        if ((bool)uptake_mask[i] != consumes) {
+            uptake_mask[i] = consumes;
+            uptake_row_count[y + z * y_len] += consumes ? 1 : -1;
+        }
+    }
+
+    void ClearUptake() {
+        std::fill(uptake_mask.begin(), uptake_mask.end(), 0);
+        std::fill(uptake_row_count.begin(), uptake_row_count.end(), 0);
+    }
+
+    /// Hold the x-row at (y, z) at val at the end of every Step()
+    void SetSourceRow(size_t y, size_t z, double val) {
+        if (source_rows.size() == 0) {
+            source_rows.resize(y_len * z_len, std::numeric_limits<double>::quiet_NaN());
+        }
+        source_rows[y + z * y_len] = val;
+    }
+
+    void ClearSourceRows() {
+        source_rows.resize(0);
+    }
+
+    /// One full time step: uptake, Diffuse(), Update() and then resetting
+    /// source rows. Anything staged with SetNextVal/DecNextVal is added in.
+    /// All of it happens row by row in a single sweep over the grid, rather
+    /// than one pass for each piece, with the same results.
+    void Step() {
+        last_change = ReduceRange(y_len * z_len, [this](size_t first_row, size_t last_row){
+            Change change;
+            for (size_t row = first_row; row < last_row; row++) {
+                change.Add(StepRow(row % y_len, row / y_len));
             }
+            return change;
+        });
+        ClearStaged();
+        std::swap(curr_grid, next_grid);
+    }
 
-            // Handle bottom
-            if (y + 1 >= y_len) {
-                // Wrap around if toroidal and on bottom edge
-                total += curr_grid[z][0][x];
-            } else {
-                total += curr_grid[z][y+1][x];
+    /// Advance steps Step()s, computing block steps per pass over memory.
+    /// The grid is swept plane by plane along y as a wavefront: plane y is
+    /// advanced to step t as soon as its neighbors reach step t-1, so only
+    /// about 3*block planes are live at a time and stay in cache, instead of
+    /// streaming the whole grid through memory on every step. With threads,
+    /// each one sweeps its own range of planes plus block planes of overlap
+    /// on each side. Results are bit-identical to calling Step() repeatedly.
+    void StepBlocked(size_t steps, size_t block) {
+        if (Periodic(1) || block < 2) {
+            // Wrapping planes around would need the far end of the grid before
+            // it has been computed, so grids periodic in y take the plain path
+            for (size_t i = 0; i < steps; i++) {
+                Step();
             }
+            return;
+        }
 
-            // Handle below
-            if (z <= 0) {
-                // Wrap around if toroidal and on top edge
-                total += curr_grid[z_len - 1][y][x];
-            } else {
-                // Otherwise no adjustment is needed
-                total += curr_grid[z-1][y][x];
+        while (steps > 0) {
+            const size_t levels = std::min(steps, block);
+            size_t num_chunks = UsePool() ? pool->GetNumThreads() : 1;
+            // Chunks much thinner than their overlap would mostly redo work
+            num_chunks = std::max((size_t)1, std::min(num_chunks, y_len / (2 * levels)));
+            emp::vector<WavefrontChunk> chunks(num_chunks);
+            for (size_t c = 0; c < num_chunks; c++) {
+                PrepareChunk(chunks[c], y_len * c / num_chunks, y_len * (c + 1) / num_chunks, levels);
             }
 
-            // Handle above
-            if (z + 1 >= z_len) {
-                // Wrap around if toroidal and on bottom edge
-                total += curr_grid[0][y][x];
+            if (num_chunks > 1) {
+                pool->Run([&](size_t id){if (id < num_chunks) SweepChunk(chunks[id]);});
             } else {
-                total += curr_grid[z+1][y][x];
+                SweepChunk(chunks[0]);
             }
 
+            // Every plane was already clamped, so this just swaps the grids
+            // and measures how far the whole pass moved things. That's
+            // reported per step, averaged over the pass, so it means the same
+            // as it does after Step().
+            next_written = true;
+            Update();
+            last_change.max /= levels;
+            last_change.sum_sq /= (double)(levels * levels);
+            steps -= levels;
+        }
+    }
+
+    /// Advance the grid by dt time units (one Step() being one unit) in a
+    /// single backward Euler step: solves
+    ///
+    ///     (c - old) / dt = coef * (neighbors - 6c) - uptake(c)
+    ///
+    /// for every voxel at once with the multigrid solver (source rows held
+    /// fixed), relinearizing uptake around the latest solution before every
+    /// cycle like SolveSteadyState(). The step is stable (and stays
+    /// non-negative) for any dt, unlike the explicit stencil which needs
+    /// coefficient <= 1/6. Nothing is split, so a grid at steady state stays
+    /// exactly where it is and long runs of large steps settle where
+    /// SolveSteadyState() does; large steps only trade away accuracy on the
+    /// way there. Cycles stop once the largest residual (a per-step change,
+    /// like SolveSteadyState()'s tolerance) is below tolerance or max_cycles
+    /// is reached. Anything staged with SetNextVal/DecNextVal is added to the
+    /// old values first. Returns the number of cycles run.
+    size_t StepImplicit(double dt, double tolerance = 1e-10, size_t max_cycles = 50) {
+        return SolveBackwardEuler(1.0 / dt, tolerance, max_cycles);
+    }
+
+    /// Jump straight to the steady state that repeated Step()s would settle
+    /// into, given the current uptake and source rows: every voxel satisfies
+    /// coef * (neighbors - 6c) = uptake(c). Starts from the current grid (so
+    /// small changes between calls converge quickly) and runs multigrid
+    /// cycles until the largest remaining per-step change is below tolerance
+    /// or max_cycles is reached. Michaelis-Menten uptake is linearized around
+    /// the latest solution before every cycle (a Newton step). Anything
+    /// staged with SetNextVal/DecNextVal is applied first. Returns the
+    /// number of cycles run.
+    size_t SolveSteadyState(double tolerance, size_t max_cycles) {
+        return SolveBackwardEuler(0, tolerance, max_cycles);
+    }
+
+    /// Largest per-step change left after the last SolveSteadyState() or
+    /// StepImplicit()
+    double GetSteadyStateResidual() const {
+        return steady_state_residual;
+    }
+
+    /// Make the next grid current. Without a Diffuse() first, the next grid
+    /// is just whatever was staged.
+    void Update() {
+        if (!next_written) {
+            ForRows(y_len * z_len, [this](size_t first_row, size_t last_row){
+                for (size_t row = first_row; row < last_row; row++) {
+                    T * next = next_grid.data() + row * y_stride;
+                    if (HasStagedRow(row)) {
+                        std::copy(staged.data() + row * y_stride, staged.data() + (row + 1) * y_stride, next);
+                    } else {
+                        std::fill(next, next + x_len, 0.0);
+                    }
+                }
+            });
+        }
+        ClearStaged();
+        next_written = false;
+        std::swap(curr_grid, next_grid);
+        last_change = ReduceRange(curr_grid.size(), [this](size_t begin, size_t end){return ResetRange(begin, end);});
+    }
+
+    /// Largest absolute change to any voxel made by the last Update() (for
+    /// StepBlocked(), by its last pass divided by the steps the pass took)
+    double GetMaxChange() const {
+        return last_change.max;
+    }
+
+    /// Root of the summed squared changes made by the last Update() (per
+    /// step, like GetMaxChange())
+    double GetL2Change() const {
+        return std::sqrt(last_change.sum_sq);
+    }
+
+    double GetNeighborOxygen(size_t x, size_t y, size_t z) {
+        const size_t i = Index(x, y, z);
+        const size_t pos[3] = {x, y, z};
+        const size_t len[3] = {x_len, y_len, z_len};
+        const size_t stride[3] = {1, y_stride, z_stride};
+
+        // Left, right, top, bottom, below, above
+        double total = 0;
+        for (size_t face = 0; face < 6; face++) {
+            const size_t axis = face / 2;
+            total += NeighborVal(i, pos[axis], len[axis], stride[axis], (Face) face);
+        }
+        return total;
+    }
 
+    /// Fill the next grid with the current one after one step of diffusion,
+    /// plus anything staged
+    void Diffuse() {
+        if (UsePool()) {
+            // Rows are numbered z-major, so each thread gets a slab of
+            // whole z-layers (or a y-range within one when z_len is small)
+            pool->ParallelFor(y_len * z_len, [this](size_t begin, size_t end){DiffuseRows(begin, end);});
         } else {
-            // No-flux/Dirichlet
+            DiffuseRows(0, y_len * z_len);
+        }
+        ClearStaged();
+        next_written = true;
+    }
 
-            // Handle left
-            if (x <= 0) {
-                // Do the Drichelet thing
-                total += curr_grid[z][y][x];
-            } else {
-                // Otherwise no adjustment is needed
-                total += curr_grid[z][y][x-1];
+    private:
+    // SolveSteadyState() and StepImplicit(): solve
+    //     inv_dt * (c - old) = coef * (neighbors - 6c) - uptake(c)
+    // with the multigrid solver, where inv_dt = 0 is the steady state
+    size_t SolveBackwardEuler(double inv_dt, double tolerance, size_t max_cycles) {
+        steady_state_solver.Setup(x_len, y_len, z_len, diffusion_coefficient,
+                                  {Periodic(0), Periodic(1), Periodic(2)}, UsePool() ? pool.get() : nullptr);
+        MultigridSolver::Level & fine = steady_state_solver.Fine();
+        for (size_t row = 0; row < y_len * z_len; row++) {
+            const bool staged_row = HasStagedRow(row);
+            for (size_t i = row * y_stride; i < (row + 1) * y_stride; i++) {
+                fine.u[i] = std::max(0.0, curr_grid[i] + (staged_row ? staged[i] : 0.0));
+                fine.pinned[i] = IsSourceRow(row);
+                if (fine.pinned[i]) {
+                    fine.u[i] = source_rows[row];
+                }
             }
+        }
+        ClearStaged();
+        steady_state_solver.Prepare();
 
-            // Handle right
-            if (x + 1 >= x_len) {
-                // Do the Drichelet thing
-                total += curr_grid[z][y][x];
-            } else {
-                total += curr_grid[z][y][x+1];
+        // The old values, which the time derivative is taken from
+        if (inv_dt > 0) {
+            implicit_old = fine.u;
+        }
+
+        // A Dirichlet face pulls the voxels next to it towards its value,
+        // which the solver sees as a sink (coef * c) plus a source (coef * value)
+        emp::vector<double> edge_k;
+        emp::vector<double> edge_b;
+        if (std::count(boundary, boundary + 6, Boundary::DIRICHLET)) {
+            edge_k.resize(curr_grid.size(), 0.0);
+            edge_b.resize(curr_grid.size(), 0.0);
+            const size_t len[3] = {x_len, y_len, z_len};
+            for (size_t z = 0; z < z_len; z++) {
+                for (size_t y = 0; y < y_len; y++) {
+                    for (size_t x = 0; x < x_len; x++) {
+                        const size_t pos[3] = {x, y, z};
+                        for (size_t face = 0; face < 6; face++) {
+                            const size_t axis = face / 2;
+                            const bool on_face = (face & 1) ? pos[axis] + 1 == len[axis] : pos[axis] == 0;
+                            if (on_face && boundary[face] == Boundary::DIRICHLET) {
+                                edge_k[Index(x, y, z)] += diffusion_coefficient;
+                                edge_b[Index(x, y, z)] += diffusion_coefficient * boundary_value[face];
+                            }
+                        }
+                    }
+                }
             }
+        }
 
-            // Handle top
-            if (y <= 0) {
-                // Do the Drichelet thing
-                total += curr_grid[z][y][x];
-            } else {
-                // Otherwise no adjustment is needed
-                total += curr_grid[z][y-1][x];
+        // A time step always takes at least one cycle: a field changing by
+        // less than tolerance per step would otherwise never move at all
+        const size_t min_cycles = inv_dt > 0 ? 1 : 0;
+        size_t cycles = 0;
+        while (true) {
+            // uptake(c) = rate * c / (c + km) ~= uptake(c0) + uptake'(c0) * (c - c0)
+            for (size_t i = 0; i < fine.u.size(); i++) {
+                fine.k[i] = (edge_k.size() ? edge_k[i] : 0.0) + inv_dt;
+                fine.b[i] = (edge_b.size() ? edge_b[i] : 0.0) + (inv_dt > 0 ? inv_dt * implicit_old[i] : 0.0);
+                if (uptake_mask.size() && uptake_mask[i]) {
+                    const double c0 = fine.u[i];
+                    const double denom = (c0 + uptake_km) * (c0 + uptake_km);
+                    fine.k[i] += uptake_rate * uptake_km / denom;
+                    fine.b[i] -= uptake_rate * c0 * c0 / denom;
+                }
             }
+            steady_state_residual = steady_state_solver.MaxResidual();
+            if ((steady_state_residual < tolerance && cycles >= min_cycles) || cycles >= max_cycles) {
+                break;
+            }
+            steady_state_solver.Cycle();
+            for (double & val : fine.u) {
+                val = std::max(0.0, val);
+            }
+            cycles++;
+        }
 
-            // Handle bottom
-            if (y + 1 >= y_len) {
-                // Do the Drichelet thing
-                total += curr_grid[z][y][x];
-            } else {
-                total += curr_grid[z][y+1][x];
+        std::copy(fine.u.begin(), fine.u.end(), curr_grid.begin());
+        return cycles;
+    }
+
+    // Where SetNextVal/DecNextVal write: straight into the next grid once
+    // Diffuse() has filled it, otherwise into the staging buffer
+    T & NextVal(size_t i) {
+        if (next_written) {
+            return next_grid[i];
+        }
+        if (staged.size() == 0) {
+            staged.resize(curr_grid.size(), 0);
+            staged_rows.resize(y_len * z_len, 0);
+        }
+        staged_rows[i / y_stride] = 1;
+        staged_voxels.push_back(i);
+        return staged[i];
+    }
+
+    bool Periodic(size_t axis) const {
+        return boundary[2 * axis] == Boundary::PERIODIC;
+    }
+
+    // Neighbor of voxel i (at pos along an axis with the given length and
+    // stride) across face
+    double NeighborVal(size_t i, size_t pos, size_t len, size_t stride, Face face) const {
+        const bool up = face & 1;
+        if (up ? pos + 1 < len : pos > 0) {
+            return curr_grid[up ? i + stride : i - stride];
+        }
+        switch (boundary[face]) {
+            case Boundary::PERIODIC:
+                return curr_grid[up ? i - (len - 1) * stride : i + (len - 1) * stride];
+            case Boundary::DIRICHLET:
+                return boundary_value[face];
+            default:
+                return curr_grid[i];
+        }
+    }
+
+    // What stands in for the row (or voxel) self past face: the wrapped
+    // around row, a row of the face's value or self again
+    const T * OffGridRow(Face face, const T * self, const T * wrapped) const {
+        switch (boundary[face]) {
+            case Boundary::PERIODIC:
+                return wrapped;
+            case Boundary::DIRICHLET:
+                return ghost_rows[face].data();
+            default:
+                return self;
+        }
+    }
+
+    bool HasStagedRow(size_t row) const {
+        return staged_rows.size() && staged_rows[row];
+    }
+
+    // Only the voxels that were touched need resetting
+    void ClearStaged() {
+        for (size_t i : staged_voxels) {
+            staged[i] = 0;
+            staged_rows[i / y_stride] = 0;
+        }
+        staged_voxels.clear();
+    }
+
+    // Expects the grids to have just been swapped, so next_grid still holds
+    // the old values (which the next step overwrites)
+    Change ResetRange(size_t begin, size_t end) {
+        Change change;
+        for (size_t i = begin; i < end; i++) {
+            // Make sure there are no negative numbers in the
+            // new curr_grid
+            if (curr_grid[i] < 0) {
+                curr_grid[i] = 0;
             }
 
-            // Handle below
-            if (z <= 0) {
-                // Do the Drichelet thing
-                total += curr_grid[z][y][x];
-            } else {
-                // Otherwise no adjustment is needed
-                total += curr_grid[z-1][y][x];
+            const double diff = std::abs(curr_grid[i] - next_grid[i]);
+            change.max = std::max(change.max, diff);
+            change.sum_sq += diff * diff;
+        }
+        return change;
+    }
+
+    void DiffuseRows(size_t first_row, size_t last_row) {
+        for (size_t row = first_row; row < last_row; row++) {
+            DiffuseRow(row % y_len, row / y_len);
+        }
+    }
+
+    // Row on the low/high side of the row starting at c along an axis with
+    // the given length and stride. Off the edge of the grid, the policy of
+    // the face decides.
+    const T * LowerRow(const T * c, size_t pos, size_t len, size_t stride, Face face) const {
+        if (pos > 0) {
+            return c - stride;
+        }
+        return OffGridRow(face, c, c + (len - 1) * stride);
+    }
+
+    const T * UpperRow(const T * c, size_t pos, size_t len, size_t stride, Face face) const {
+        if (pos + 1 < len) {
+            return c + stride;
+        }
+        return OffGridRow(face, c, c - (len - 1) * stride);
+    }
+
+    // Stencil update for voxel x of row c, with the same edge handling and
+    // summation order as GetNeighborOxygen and the same arithmetic as the
+    // row kernels (2 is the central difference weight per dimension)
+    ACC StencilVoxel(const T * c, const T * y_lo, const T * y_hi,
+                     const T * z_lo, const T * z_hi, size_t x, bool planar) const {
+        const ACC center = c[x];
+        const ACC left = x > 0 ? c[x - 1] : *OffGridRow(X_LOW, c + x, c + x_len - 1);
+        const ACC right = x + 1 < x_len ? c[x + 1] : *OffGridRow(X_HIGH, c + x, c);
+        ACC neighbors = left + right + (ACC) y_lo[x] + (ACC) y_hi[x];
+        if (!planar) {
+            neighbors = neighbors + (ACC) z_lo[x] + (ACC) z_hi[x];
+        }
+        return center + ((ACC) diffusion_coefficient * (neighbors - ((ACC) (planar ? 4 : 6) * center)));
+    }
+
+    // Boundaries in y and z are resolved once per row by the caller picking
+    // which rows act as neighbors, so only the two voxels at the ends of the
+    // row need edge handling and the rest is straight-line kernel code.
+    void StencilRow(T * next, const T * c, const T * y_lo, const T * y_hi,
+                    const T * z_lo, const T * z_hi) const {
+        const bool planar = IsPlanar();
+        next[0] = StencilVoxel(c, y_lo, y_hi, z_lo, z_hi, 0, planar);
+        if (x_len < 2) {
+            return;
+        }
+        (planar ? planar_row_kernel : row_kernel)(next, c, y_lo, y_hi, z_lo, z_hi, 1, x_len - 1, diffusion_coefficient);
+        next[x_len - 1] = StencilVoxel(c, y_lo, y_hi, z_lo, z_hi, x_len - 1, planar);
+    }
+
+    void DiffuseRow(size_t y, size_t z) {
+        const T * c = curr_grid.data() + Index(0, y, z);
+        T * next = next_grid.data() + Index(0, y, z);
+        StencilRow(next, c, LowerRow(c, y, y_len, y_stride, Y_LOW), UpperRow(c, y, y_len, y_stride, Y_HIGH),
+                   LowerRow(c, z, z_len, z_stride, Z_LOW), UpperRow(c, z, z_len, z_stride, Z_HIGH));
+        AddSinksRow(next, c, y + z * y_len, true, false);
+    }
+
+    // All of Step() for one row: stencil, staged changes and uptake, clamp
+    // and source, writing into the next grid. The change is measured on the
+    // final values, after the source is reset, like Update() measures it.
+    Change StepRow(size_t y, size_t z) {
+        const size_t row = y + z * y_len;
+        const T * c = curr_grid.data() + Index(0, y, z);
+        T * next = next_grid.data() + Index(0, y, z);
+        StencilRow(next, c, LowerRow(c, y, y_len, y_stride, Y_LOW), UpperRow(c, y, y_len, y_stride, Y_HIGH),
+                   LowerRow(c, z, z_len, z_stride, Z_LOW), UpperRow(c, z, z_len, z_stride, Z_HIGH));
+        AddSinksRow(next, c, row, true, true);
+        const bool source = IsSourceRow(row);
+        const T source_val = source ? (T) source_rows[row] : 0;
+        Change change;
+        for (size_t x = 0; x < x_len; x++) {
+            if (next[x] < 0) {
+                next[x] = 0;
             }
+            if (source) {
+                next[x] = source_val;
+            }
+            const double diff = std::abs(next[x] - c[x]);
+            change.max = std::max(change.max, diff);
+            change.sum_sq += diff * diff;
+        }
+        return change;
+    }
 
-            // Handle above
-            if (z + 1 >= z_len) {
-                // Do the Drichelet thing
-                total += curr_grid[z][y][x];
-            } else {
-                total += curr_grid[z+1][y][x];
+    // Add what was staged for the row and/or uptake (which depends on the
+    // old values c) onto the stencil results already in next. The sink is
+    // totalled first and added last, which rounds exactly like adding the
+    // stencil onto a next grid that already held the sinks.
+    void AddSinksRow(T * next, const T * c, size_t row, bool with_staged, bool with_uptake) const {
+        const T * s = with_staged && HasStagedRow(row) ? staged.data() + row * y_stride : nullptr;
+        const unsigned char * mask = with_uptake && uptake_row_count.size() && uptake_row_count[row]
+                                     ? uptake_mask.data() + row * y_stride : nullptr;
+        if (!s && !mask) {
+            return;
+        }
+        for (size_t x = 0; x < x_len; x++) {
+            const bool takes_up = mask && mask[x];
+            if (!s && !takes_up) {
+                continue;
             }
+            double sink = s ? s[x] : 0.0;
+            if (takes_up) {
+                sink -= uptake_rate * (c[x] / (c[x] + uptake_km));
+            }
+            next[x] += sink;
+        }
+    }
+
+    void ApplySourceRow(T * row_data, size_t row) const {
+        if (!std::isnan(source_rows[row])) {
+            std::fill(row_data, row_data + x_len, source_rows[row]);
         }
+    }
 
+    bool IsSourceRow(size_t row) const {
+        return source_rows.size() && !std::isnan(source_rows[row]);
+    }
+
+    // Run fun(first_row, last_row) over all rows, split across the pool
+    // when it is worth it
+    template <typename FUN>
+    void ForRows(size_t num_rows, const FUN & fun) {
+        if (UsePool()) {
+            pool->ParallelFor(num_rows, [&fun](size_t begin, size_t end){fun(begin, end);});
+        } else {
+            fun(0, num_rows);
+        }
+    }
+
+    // Like ForRows, for functions returning how much they changed the grid.
+    // Per-thread results are combined in a fixed order so the totals don't
+    // depend on which thread finishes first.
+    template <typename FUN>
+    Change ReduceRange(size_t n, const FUN & fun) {
+        if (!UsePool()) {
+            return fun(0, n);
+        }
+        const size_t num_threads = pool->GetNumThreads();
+        emp::vector<Change> changes(num_threads);
+        pool->Run([&](size_t id){
+            changes[id] = fun(n * id / num_threads, n * (id + 1) / num_threads);
+        });
+        Change total;
+        for (const Change & change : changes) {
+            total.Add(change);
+        }
         return total;
     }
 
-    void Diffuse() {
+    // A y-plane (every z-row at one y) inside some buffer
+    struct Plane {
+        T * base;
+        size_t row_stride;
+        T * Row(size_t z) const {return base + z * row_stride;}
+    };
+
+    Plane GridPlane(buffer_t & grid, size_t y) {
+        return Plane{grid.data() + y * y_stride, z_stride};
+    }
+
+    // State for one thread's share of a StepBlocked() pass. The chunk writes
+    // planes [y_begin, y_end) of the result, which needs planes
+    // [y_begin - levels, y_end + levels) of the input (clipped to the grid).
+    struct WavefrontChunk {
+        size_t y_begin;
+        size_t y_end;
+        size_t ext_begin;
+        size_t ext_end;
+        size_t levels;
+        emp::vector<T> rings;         // 3 planes for each intermediate step
+    };
+
+    void PrepareChunk(WavefrontChunk & chunk, size_t y_begin, size_t y_end, size_t levels) {
+        chunk.y_begin = y_begin;
+        chunk.y_end = y_end;
+        chunk.ext_begin = y_begin > levels ? y_begin - levels : 0;
+        chunk.ext_end = std::min(y_len, y_end + levels);
+        chunk.levels = levels;
+    }
+
+    // One Step() for plane y: reads the previous step from lo/mid/hi and
+    // writes into out. Staged changes belong to the first step only.
+    void StepPlane(Plane out, Plane lo, Plane mid, Plane hi, size_t y, bool first_step) const {
         for (size_t z = 0; z < z_len; z++) {
+            const size_t row = y + z * y_len;
+            T * next = out.Row(z);
+            const T * c = mid.Row(z);
+            // Planes off the edge in y come in as null
+            StencilRow(next, c, lo.base ? lo.Row(z) : OffGridRow(Y_LOW, c, nullptr),
+                       hi.base ? hi.Row(z) : OffGridRow(Y_HIGH, c, nullptr),
+                       z > 0 ? mid.Row(z - 1) : OffGridRow(Z_LOW, c, mid.Row(z_len - 1)),
+                       z + 1 < z_len ? mid.Row(z + 1) : OffGridRow(Z_HIGH, c, mid.Row(0)));
+            AddSinksRow(next, c, row, first_step, true);
             for (size_t x = 0; x < x_len; x++) {
-                for (size_t y = 0; y < y_len; y++) {
-                    next_grid[z][y][x] += curr_grid[z][y][x] + 
-                            (diffusion_coefficient * 
-                            (GetNeighborOxygen(x, y, z) - 
-                            (6.0 * curr_grid[z][y][x]))); // 6.0 is from central difference approximation
+                if (next[x] < 0) {
+                    next[x] = 0;
                 }
             }
+            if (source_rows.size()) {
+                ApplySourceRow(next, row);
+            }
+        }
+    }
+
+    void SweepChunk(WavefrontChunk & chunk) {
+        const size_t levels = chunk.levels;
+        const size_t plane_size = z_len * x_len;
+        chunk.rings.resize(3 * (levels - 1) * plane_size);
+
+        // Planes of step t that are valid: the overlap shrinks by one plane
+        // per step, except where it is clipped by the edge of the grid
+        auto first_valid = [&](size_t t){return chunk.ext_begin == 0 ? 0 : chunk.ext_begin + t;};
+        auto last_valid = [&](size_t t){return chunk.ext_end == y_len ? y_len : chunk.ext_end - t;};
+
+        // Step 0 is the current grid, step levels goes straight into
+        // next_grid, and steps in between live in a ring of three planes
+        auto plane_at = [&](size_t t, size_t y){
+            if (t == 0) {
+                return GridPlane(curr_grid, y);
+            }
+            if (t == levels) {
+                return GridPlane(next_grid, y);
+            }
+            return Plane{chunk.rings.data() + ((t - 1) * 3 + y % 3) * plane_size, x_len};
+        };
+
+        // Step t of plane y needs step t-1 of plane y+1, which is computed
+        // on sweep y + t - 1, so sweep p computes step t of plane p - t + 1.
+        for (size_t p = chunk.ext_begin; p < last_valid(levels) + levels - 1; p++) {
+            for (size_t t = 1; t <= levels; t++) {
+                if (p + 1 < t) {
+                    break;
+                }
+                const size_t y = p + 1 - t;
+                if (y < first_valid(t) || y >= last_valid(t)) {
+                    continue;
+                }
+                if (t == levels && (y < chunk.y_begin || y >= chunk.y_end)) {
+                    continue;
+                }
+
+                const Plane off_grid{nullptr, 0};
+                StepPlane(plane_at(t, y), y > 0 ? plane_at(t - 1, y - 1) : off_grid, plane_at(t - 1, y),
+                          y + 1 < y_len ? plane_at(t - 1, y + 1) : off_grid, y, t == 1);
+            }
         }
     }
 };
 
+using ResourceGradient = ResourceGradientT<double>;
+
 #endif
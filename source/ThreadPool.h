@@ -0,0 +1,119 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "base/vector.h"
+
+/// Fixed set of worker threads that repeatedly run the same job in lock-step.
+/// The calling thread takes part as thread 0, and Run() returns once every
+/// thread has finished, so the pool can be used inside tight loops without
+/// paying for thread creation each time.
+class ThreadPool {
+    emp::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    const std::function<void(size_t)> * job = nullptr;
+    size_t generation = 0;
+    size_t running = 0;
+    bool stopping = false;
+
+    void WorkerLoop(size_t thread_id) {
+        size_t seen_generation = 0;
+        while (true) {
+            const std::function<void(size_t)> * current_job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start_cv.wait(lock, [&](){return stopping || generation != seen_generation;});
+                if (stopping) {
+                    return;
+                }
+                seen_generation = generation;
+                current_job = job;
+            }
+
+            (*current_job)(thread_id);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running--;
+                if (running == 0) {
+                    done_cv.notify_one();
+                }
+            }
+        }
+    }
+
+    public:
+    /// num_threads counts the calling thread; 0 means one thread per core.
+    ThreadPool(size_t num_threads) {
+        if (num_threads == 0) {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+#ifdef __EMSCRIPTEN__
+        num_threads = 1; // No threads in the browser
+#endif
+        for (size_t thread_id = 1; thread_id < num_threads; thread_id++) {
+            workers.emplace_back([this, thread_id](){WorkerLoop(thread_id);});
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start_cv.notify_all();
+        for (std::thread & worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    size_t GetNumThreads() const {
+        return workers.size() + 1;
+    }
+
+    /// Call fun(thread_id) once on every thread and wait for all of them
+    void Run(const std::function<void(size_t)> & fun) {
+        if (workers.empty()) {
+            fun(0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fun;
+            running = workers.size();
+            generation++;
+        }
+        start_cv.notify_all();
+
+        fun(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [this](){return running == 0;});
+    }
+
+    /// Split [0, n) into one contiguous chunk per thread and call
+    /// fun(begin, end) on each non-empty chunk
+    void ParallelFor(size_t n, const std::function<void(size_t, size_t)> & fun) {
+        const size_t num_threads = GetNumThreads();
+        Run([n, num_threads, &fun](size_t thread_id){
+            size_t begin = n * thread_id / num_threads;
+            size_t end = n * (thread_id + 1) / num_threads;
+            if (begin < end) {
+                fun(begin, end);
+            }
+        });
+    }
+};
+
+#endif
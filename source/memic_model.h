@@ -1,7 +1,19 @@
 #ifndef _MEMIC_MODEL_H
 #define _MEMIC_MODEL_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "CounterRandom.h"
+#include "LookupTable.h"
+#include "ObjectPool.h"
+#include "ProgressReporter.h"
 #include "ResourceGradient.h"
+#include "ThreadPool.h"
 #include "config/ArgManager.h"
 #include "tools/File.h"
 #include "Evolve/World.h"
@@ -18,7 +30,11 @@ EMP_BUILD_CONFIG( MemicConfig,
   VALUE(PLATE_DEPTH, double, 1.45, "Depth of plate in mm"), 
   VALUE(CELL_DIAMETER, double, 20.0, "Cell length and width in microns"),
   VALUE(INIT_POP_SIZE, int, 100, "Number of cells to seed population with"),
+  VALUE(CELL_DIMENSIONS, int, 2, "Dimensions cells live in: 2 (the bottom layer of the plate) or 3 (every layer of the plate, dividing into any of 26 neighboring spots)"),
   VALUE(DATA_RESOLUTION, int, 10, "How many updates between printing data?"),
+  VALUE(RANDOM_STREAMS, std::string, "shared", "Where cells get random numbers: shared (one generator, drawn from in order) or per_cell (a separate counter-based stream for every cell and update, so results don't depend on the number of threads or the order cells are visited in)"),
+  VALUE(PROGRESS_INTERVAL, int, 0, "How many updates between progress reports on the screen? (0 means never)"),
+  VALUE(PROGRESS_FORMAT, std::string, "Update {update}/{total}: {rate} updates/s, ETA {eta}s, {pop} cells ({phases})", "Format of progress reports: {update}, {total}, {rate} (updates/sec), {eta} (seconds), {pop} and {phases} (time spent per phase) are filled in"),
 
   GROUP(CELL, "Cell settings"),
   VALUE(NEUTRAL_MUTATION_RATE, double, .05, "Probability of a neutral mutation (only relevant for phylogenetic signature)"),
@@ -28,11 +44,21 @@ EMP_BUILD_CONFIG( MemicConfig,
   VALUE(AGE_LIMIT, int, 100, "Age over which non-stem cells die"),
   VALUE(BASAL_OXYGEN_CONSUMPTION, double, .00075, "Base oxygen consumption rate"),
   VALUE(OXYGEN_CONSUMPTION_DIVISION, double, .00075*5, "Amount of oxygen a cell consumes on division"),
+  VALUE(AGENT_THREADS, int, 1, "Number of threads to update cells with (0 means one per core; anything but 1 gives each band of rows its own random number stream, so results don't depend on the number of threads)"),
   
   GROUP(OXYGEN, "Oxygen settings"),
   VALUE(INITIAL_OXYGEN_LEVEL, double, .5, "Initial oxygen level (will be placed in all cells)"),
   VALUE(OXYGEN_DIFFUSION_COEFFICIENT, double, .1, "Oxygen diffusion coefficient"),
   VALUE(DIFFUSION_STEPS_PER_TIME_STEP, int, 100, "Rate at which diffusion is calculated relative to rest of model"),
+  VALUE(DIFFUSION_THREADS, int, 1, "Number of threads to calculate diffusion with (0 means one per core)"),
+  VALUE(DIFFUSION_TOLERANCE, double, 0, "Stop diffusion steps early once no voxel changes by more than this in a step (averaged over each pass with DIFFUSION_TIME_BLOCK; 0 means always take DIFFUSION_STEPS_PER_TIME_STEP steps)"),
+  VALUE(MIN_DIFFUSION_STEPS, int, 1, "Fewest diffusion steps to take per time step when stopping early"),
+  VALUE(DIFFUSION_TIME_BLOCK, int, 1, "Diffusion steps to compute per pass over the grid (1 means no temporal blocking)"),
+  VALUE(OXYGEN_SOLVER, std::string, "explicit", "How to calculate diffusion: explicit (DIFFUSION_STEPS_PER_TIME_STEP small steps), implicit (IMPLICIT_DIFFUSION_STEPS large steps covering the same time) or steady (solve for steady state every time step)"),
+  VALUE(IMPLICIT_DIFFUSION_STEPS, int, 1, "Number of implicit steps per time step (only used by the implicit solver)"),
+  VALUE(STEADY_STATE_TOLERANCE, double, 1e-9, "Largest per-step oxygen change allowed in a steady state solution (only used by the steady solver)"),
+  VALUE(STEADY_STATE_MAX_CYCLES, int, 50, "Most multigrid cycles to spend on a steady state solution per time step (only used by the steady solver)"),
+  VALUE(OXYGEN_PRECISION, std::string, "double", "How to store oxygen levels: double, float, or mixed (stored as float, diffused in double precision)"),
   VALUE(OXYGEN_THRESHOLD, double, .1, "How much oxygen do cells need to survive?"),
   VALUE(KM, double, 0.01, "Michaelis-Menten kinetic parameter"),
 
@@ -64,9 +90,26 @@ struct Cell {
       return clade < other.clade;
     }
 
+    // The whole population is replaced every update, so cells come from a
+    // pool instead of a fresh heap allocation each time
+    static void * operator new(size_t size) {
+      return size == sizeof(Cell) ? ObjectPool<Cell>::Allocate() : ::operator new(size);
+    }
+
+    static void operator delete(void * ptr, size_t size) {
+      if (size == sizeof(Cell)) {
+        ObjectPool<Cell>::Release(ptr);
+      } else {
+        ::operator delete(ptr);
+      }
+    }
+
 };
 
-class HCAWorld : public emp::World<Cell> {
+/// The model itself. GRADIENT is the type holding oxygen levels, so the
+/// oxygen field can be stored in single precision (see OXYGEN_PRECISION).
+template <typename GRADIENT = ResourceGradient>
+class HCAWorldT : public emp::World<Cell> {
   protected:
   int TIME_STEPS;
   double NEUTRAL_MUTATION_RATE;
@@ -77,8 +120,18 @@ class HCAWorld : public emp::World<Cell> {
   double OXYGEN_CONSUMPTION_DIVISION;
   double HYPOXIA_DEATH_PROB;
   int AGE_LIMIT;
+  int AGENT_THREADS;
+  bool PER_CELL_RANDOM;
   int INIT_POP_SIZE;
   int DIFFUSION_STEPS_PER_TIME_STEP;
+  int DIFFUSION_THREADS;
+  double DIFFUSION_TOLERANCE;
+  int MIN_DIFFUSION_STEPS;
+  int DIFFUSION_TIME_BLOCK;
+  std::string OXYGEN_SOLVER;
+  int IMPLICIT_DIFFUSION_STEPS;
+  double STEADY_STATE_TOLERANCE;
+  int STEADY_STATE_MAX_CYCLES;
   double BASAL_OXYGEN_CONSUMPTION;
   double INITIAL_OXYGEN_LEVEL;
   double KM;
@@ -98,8 +151,10 @@ class HCAWorld : public emp::World<Cell> {
   size_t WORLD_X;
   size_t WORLD_Y;
   size_t WORLD_Z;
+  size_t CELL_LAYERS = 1; // Layers of the plate cells live in (WORLD_Z if CELL_DIMENSIONS is 3)
 
   int next_clade = 1;
+  int diffusion_steps_taken = 0; // Diffusion steps (or multigrid cycles) in the last time step
 
   emp::vector<emp::vector<double>> densities;
   emp::vector<emp::vector<double>> diversities;
@@ -108,16 +163,65 @@ class HCAWorld : public emp::World<Cell> {
   int next_radiation_time = -1;
   int next_radiation_index = 0;
 
+  // Surviving fraction against oxygen level, tabulated for each dose (n
+  // doses of d Gy) in use
+  struct DoseTable {
+    double n;
+    double d;
+    LookupTable table;
+  };
+  emp::vector<DoseTable> dose_tables;
+
+  // Which positions hold a living cell, kept up to date as cells are placed
+  // and die: one bit per position, plus a dense list of the occupied
+  // positions for sweeps that don't care about order
+  emp::vector<uint64_t> occupied_bits;
+  emp::vector<size_t> occupied_ids;
+  emp::vector<uint32_t> occupied_slot; // Where each occupied position is in occupied_ids (32 bits, as a 3D plate has a lot of empty positions)
+  emp::vector<uint64_t> frontier_bits; // Cells with an empty neighbor, as of the start of this update
+  emp::vector<uint64_t> hypoxic_bits; // Positions below OXYGEN_THRESHOLD, as of the start of this update
+
+  emp::vector<size_t> survivors; // Quiescent cells to move into the next generation
+
+  ProgressReporter progress;
+
+  /// What a living cell does this update: carries on as it is (offspring_cell
+  /// of -1) or divides into offspring_cell. Cells that die aren't listed.
+  struct CellFate {
+    size_t cell_id;
+    int offspring_cell;
+    bool mutant[2]; // Whether each daughter founds a new clade
+  };
+
+  // Fates are decided a band of rows at a time, in parallel if there's an
+  // agent pool, and then carried out in order
+  static constexpr size_t AGENT_BAND_ROWS = 8;
+  std::shared_ptr<ThreadPool> agent_pool; // Null means decide serially
+  emp::vector<emp::Random> band_random;
+  emp::vector<emp::vector<CellFate>> band_fates;
+
+  // Key for per-cell random streams (RANDOM_STREAMS per_cell), and what a
+  // stream is for, so different decisions about a cell in an update draw
+  // from different streams
+  uint64_t stream_seed = 0;
+  enum StreamPurpose : uint32_t { FATE_STREAM = 0, RADIATION_STREAM = 1 };
+
   std::function<double()> colless_fun = [this](){return GetSystematics()->CollessLikeIndex();};
   std::function<double()> sackin_fun = [this](){return GetSystematics()->SackinIndex();};
+  std::function<size_t()> pool_live_fun = [](){return ObjectPool<Cell>::GetLive();};
+  std::function<size_t()> pool_capacity_fun = [](){return ObjectPool<Cell>::GetCapacity();};
 
   public:
-  emp::Ptr<ResourceGradient> oxygen;
+  emp::Ptr<GRADIENT> oxygen;
 
-  HCAWorld(emp::Random & r) : emp::World<Cell>(r), oxygen(nullptr) {;}
-  HCAWorld() {;}
+  HCAWorldT(emp::Random & r) : emp::World<Cell>(r), oxygen(nullptr) {
+    TrackOccupancy();
+  }
+  HCAWorldT() {
+    TrackOccupancy();
+  }
 
-  ~HCAWorld() {
+  ~HCAWorldT() {
     if (oxygen) {
       oxygen.Delete();
     }
@@ -133,8 +237,38 @@ class HCAWorld : public emp::World<Cell> {
     OXYGEN_CONSUMPTION_DIVISION = config.OXYGEN_CONSUMPTION_DIVISION();
     HYPOXIA_DEATH_PROB = config.HYPOXIA_DEATH_PROB();
     AGE_LIMIT = config.AGE_LIMIT();
+    AGENT_THREADS = config.AGENT_THREADS();
+    if (AGENT_THREADS < 0) {
+      throw std::invalid_argument("AGENT_THREADS must be 0 (one thread per core) or more, not " + std::to_string(AGENT_THREADS));
+    }
+    if (config.RANDOM_STREAMS() != "shared" && config.RANDOM_STREAMS() != "per_cell") {
+      throw std::invalid_argument("RANDOM_STREAMS must be shared or per_cell, not \"" + config.RANDOM_STREAMS() + "\"");
+    }
+    PER_CELL_RANDOM = config.RANDOM_STREAMS() == "per_cell";
     INITIAL_OXYGEN_LEVEL = config.INITIAL_OXYGEN_LEVEL();
     DIFFUSION_STEPS_PER_TIME_STEP = config.DIFFUSION_STEPS_PER_TIME_STEP();
+    DIFFUSION_THREADS = config.DIFFUSION_THREADS();
+    if (DIFFUSION_THREADS < 0) {
+      throw std::invalid_argument("DIFFUSION_THREADS must be 0 (one thread per core) or more, not " + std::to_string(DIFFUSION_THREADS));
+    }
+    DIFFUSION_TOLERANCE = config.DIFFUSION_TOLERANCE();
+    MIN_DIFFUSION_STEPS = config.MIN_DIFFUSION_STEPS();
+    DIFFUSION_TIME_BLOCK = config.DIFFUSION_TIME_BLOCK();
+    OXYGEN_SOLVER = config.OXYGEN_SOLVER();
+    if (OXYGEN_SOLVER != "explicit" && OXYGEN_SOLVER != "implicit" && OXYGEN_SOLVER != "steady") {
+      throw std::invalid_argument("OXYGEN_SOLVER must be explicit, implicit or steady, not \"" + OXYGEN_SOLVER + "\"");
+    }
+    IMPLICIT_DIFFUSION_STEPS = config.IMPLICIT_DIFFUSION_STEPS();
+    STEADY_STATE_TOLERANCE = config.STEADY_STATE_TOLERANCE();
+    STEADY_STATE_MAX_CYCLES = config.STEADY_STATE_MAX_CYCLES();
+    // The steady solver would skip solving with no cycles, and never stop
+    // with a negative count (read as a huge one) or tolerance
+    if (OXYGEN_SOLVER == "steady" && STEADY_STATE_MAX_CYCLES < 1) {
+      throw std::invalid_argument("STEADY_STATE_MAX_CYCLES must be at least 1, not " + std::to_string(STEADY_STATE_MAX_CYCLES));
+    }
+    if (OXYGEN_SOLVER == "steady" && !(STEADY_STATE_TOLERANCE >= 0)) {
+      throw std::invalid_argument("STEADY_STATE_TOLERANCE must be 0 or more, not " + std::to_string(STEADY_STATE_TOLERANCE));
+    }
     BASAL_OXYGEN_CONSUMPTION = config.BASAL_OXYGEN_CONSUMPTION();
     KM = config.KM();
     INIT_POP_SIZE = config.INIT_POP_SIZE();
@@ -142,6 +276,8 @@ class HCAWorld : public emp::World<Cell> {
     PLATE_WIDTH = config.PLATE_WIDTH();
     PLATE_DEPTH = config.PLATE_DEPTH();
     CELL_DIAMETER = config.CELL_DIAMETER();
+    progress.SetInterval(config.PROGRESS_INTERVAL());
+    progress.SetFormat(config.PROGRESS_FORMAT());
 
     RADIATION_DOSES = config.RADIATION_DOSES();
     RADIATION_DOSE_SIZE = config.RADIATION_DOSE_SIZE();
@@ -153,13 +289,23 @@ class HCAWorld : public emp::World<Cell> {
     WORLD_X = (size_t)floor(PLATE_WIDTH / (CELL_DIAMETER/1000));
     WORLD_Y = (size_t)floor(PLATE_LENGTH / (CELL_DIAMETER/1000));
     WORLD_Z = (size_t)floor(PLATE_DEPTH / (CELL_DIAMETER/1000));
+    CELL_LAYERS = config.CELL_DIMENSIONS() == 3 ? WORLD_Z : 1;
 
     if (oxygen) {
       oxygen->SetDiffusionCoefficient(OXYGEN_DIFFUSION_COEFFICIENT);
+      oxygen->SetUptakeKinetics(BASAL_OXYGEN_CONSUMPTION, KM);
     }
 
     if (config.RADIATION_PRESCRIPTION_FILE() != "none") {
-      radiation_prescription_data = emp::File(config.RADIATION_PRESCRIPTION_FILE()).KeepIf([](const std::string & s){return !emp::has_letter(s);}).ToData<double>();
+      radiation_prescription_data = emp::File(config.RADIATION_PRESCRIPTION_FILE()).KeepIf([](const std::string & s){return !emp::has_letter(s);}).template ToData<double>();
+    }
+
+    // Tabulate surviving fractions for every dose that can be given (the
+    // prescription's and the web interface's), now the OER constants are known
+    dose_tables.clear();
+    GetDoseTable(RADIATION_DOSES, RADIATION_DOSE_SIZE);
+    for (const emp::vector<double> & dose : radiation_prescription_data) {
+      GetDoseTable(dose[2], dose[1]);
     }
   }
 
@@ -175,19 +321,65 @@ class HCAWorld : public emp::World<Cell> {
     return WORLD_Z;
   }
 
+  size_t GetCellLayers() const {
+    return CELL_LAYERS;
+  }
+
+  /// Number of positions cells can live in. Position x + y * WORLD_X +
+  /// z * WORLD_X * WORLD_Y is the cell in voxel (x, y, z) of the oxygen grid.
+  size_t GetNumPositions() const {
+    return WORLD_X * WORLD_Y * CELL_LAYERS;
+  }
+
+  size_t GetPosX(size_t pos) const {
+    return pos % WORLD_X;
+  }
+
+  size_t GetPosY(size_t pos) const {
+    return pos / WORLD_X % WORLD_Y;
+  }
+
+  size_t GetPosZ(size_t pos) const {
+    return pos / (WORLD_X * WORLD_Y);
+  }
+
+  /// emp's grid neighbor functions (which DoBirth() and
+  /// GetRandomNeighborPos() use) see the layers stacked in y, so in 3D they
+  /// would take the next layer's rows for neighbors. These look at the 26
+  /// spots around a cell instead; like emp's grid, a random neighbor can be
+  /// the spot itself and the plate wraps around at its edges.
+  void SetNeighborFuns3D() {
+    SetGetNeighborFun([this](emp::WorldPosition pos) {
+      const size_t offset = random_ptr->GetUInt(27);
+      const size_t x = (GetPosX(pos.GetIndex()) + WORLD_X + offset % 3 - 1) % WORLD_X;
+      const size_t y = (GetPosY(pos.GetIndex()) + WORLD_Y + offset / 3 % 3 - 1) % WORLD_Y;
+      const size_t z = (GetPosZ(pos.GetIndex()) + CELL_LAYERS + offset / 9 - 1) % CELL_LAYERS;
+      return emp::WorldPosition(x + y * WORLD_X + z * WORLD_X * WORLD_Y, pos.GetPopID());
+    });
+    SetIsNeighborFun([this](emp::WorldPosition p1, emp::WorldPosition p2) {
+      auto close = [](size_t a, size_t b, size_t size) {
+        const size_t distance = a > b ? a - b : b - a;
+        return distance <= 1 || distance == size - 1;
+      };
+      return close(GetPosX(p1.GetIndex()), GetPosX(p2.GetIndex()), WORLD_X)
+          && close(GetPosY(p1.GetIndex()), GetPosY(p2.GetIndex()), WORLD_Y)
+          && close(GetPosZ(p1.GetIndex()), GetPosZ(p2.GetIndex()), CELL_LAYERS);
+    });
+  }
+
 
   void InitPop() {
     // for (int cell_id = 0; cell_id < WORLD_X * WORLD_Y; cell_id++) {
     //   InjectAt(Cell(CELL_STATE::HEALTHY), cell_id);
     // }
-    pop.resize(WORLD_X*WORLD_Y);
-    size_t initial_spot = random_ptr->GetUInt(WORLD_Y*WORLD_X);
+    pop.resize(GetNumPositions());
+    size_t initial_spot = random_ptr->GetUInt(GetNumPositions());
     InjectAt(Cell(), initial_spot);
 
     for (size_t cell_id = 0; cell_id < (size_t)INIT_POP_SIZE; cell_id++) {
-      size_t spot = random_ptr->GetUInt(WORLD_Y*WORLD_X);
+      size_t spot = random_ptr->GetUInt(GetNumPositions());
       while (spot == initial_spot) {
-        spot = random_ptr->GetUInt(WORLD_Y*WORLD_X);        
+        spot = random_ptr->GetUInt(GetNumPositions());        
       }
       AddOrgAt(emp::NewPtr<Cell>(), spot, initial_spot);
     }
@@ -205,19 +397,242 @@ class HCAWorld : public emp::World<Cell> {
     }
   }
 
-  ResourceGradient& GetOxygen() {
+  GRADIENT& GetOxygen() {
     return *oxygen;
   }
 
+  /// Keep the occupancy bitmap in step with the population
+  void TrackOccupancy() {
+    OnPlacement([this](size_t pos){MarkOccupied(pos);});
+    OnOrgDeath([this](size_t pos){MarkEmpty(pos);});
+    OnSwapOrgs([this](emp::WorldPosition p1, emp::WorldPosition p2){
+      for (emp::WorldPosition pos : {p1, p2}) {
+        if (pos.IsActive() && IsOccupied(pos)) {
+          MarkOccupied(pos.GetIndex());
+        } else if (pos.IsActive()) {
+          MarkEmpty(pos.GetIndex());
+        }
+      }
+    });
+  }
+
+  /// Forget every occupied position, leaving room for size positions
+  void ResetOccupancy(size_t size) {
+    occupied_bits.assign((size + 63) / 64, 0);
+    occupied_slot.assign(size, 0);
+    occupied_ids.resize(0);
+  }
+
+  void MarkOccupied(size_t pos) {
+    if (pos >= occupied_slot.size()) {
+      occupied_bits.resize(pos / 64 + 1, 0);
+      occupied_slot.resize(pos + 1, 0);
+    }
+    if (HasCell(pos)) {
+      return;
+    }
+    occupied_bits[pos / 64] |= (uint64_t)1 << (pos % 64);
+    occupied_slot[pos] = (uint32_t)occupied_ids.size();
+    occupied_ids.push_back(pos);
+  }
+
+  void MarkEmpty(size_t pos) {
+    if (!HasCell(pos)) {
+      return;
+    }
+    occupied_bits[pos / 64] &= ~((uint64_t)1 << (pos % 64));
+    // Fill the gap in the dense list with its last entry
+    const size_t last = occupied_ids.back();
+    occupied_ids[occupied_slot[pos]] = last;
+    occupied_slot[last] = occupied_slot[pos];
+    occupied_ids.pop_back();
+  }
+
+  /// Whether there is a living cell at pos (same as IsOccupied(pos), but
+  /// read from the occupancy bitmap)
+  bool HasCell(size_t pos) const {
+    return pos < occupied_slot.size() && (occupied_bits[pos / 64] >> (pos % 64) & 1);
+  }
+
+  /// Every occupied position, in no particular order
+  const emp::vector<size_t> & GetOccupiedCells() const {
+    return occupied_ids;
+  }
+
+  /// First occupied position at or after pos (or the end of the bitmap if
+  /// there isn't one), for sweeps over living cells in position order
+  size_t NextOccupied(size_t pos) const {
+    size_t word = pos / 64;
+    if (word >= occupied_bits.size()) {
+      return occupied_slot.size();
+    }
+    uint64_t bits = occupied_bits[word] & (~(uint64_t)0 << (pos % 64));
+    while (!bits) {
+      if (++word == occupied_bits.size()) {
+        return occupied_slot.size();
+      }
+      bits = occupied_bits[word];
+    }
+    return word * 64 + (size_t)__builtin_ctzll(bits);
+  }
+
+  /// Occupancy of count (at most 63) consecutive positions starting at
+  /// first, one bit per position
+  uint64_t OccupiedRun(size_t first, size_t count) const {
+    const size_t word = first / 64;
+    const size_t shift = first % 64;
+    uint64_t bits = occupied_bits[word] >> shift;
+    if (shift + count > 64) {
+      bits |= occupied_bits[word + 1] << (64 - shift);
+    }
+    return bits & (((uint64_t)1 << count) - 1);
+  }
+
+  /// Work out which cells are on the frontier (have an empty spot in their
+  /// 9-cell neighborhood, or 27-cell in 3D), from the occupancy bitmap.
+  /// Births and deaths replace most of the population every update, so this
+  /// is redone from scratch each update a word at a time rather than kept
+  /// up to date cell by cell. Stretches of rows with no cells are skipped,
+  /// so a mostly empty 3D plate costs little more than its cells.
+  void UpdateFrontier() {
+    frontier_bits.assign(occupied_bits.size(), 0);
+    if (!WORLD_Y) {
+      return;
+    }
+    // Columns are handled SPAN at a time, with room for the column on
+    // either side in one word
+    constexpr size_t SPAN = 61;
+    for (size_t x0 = 0; x0 < WORLD_X; x0 += SPAN) {
+      const size_t count = std::min(SPAN, WORLD_X - x0);
+      const size_t first_col = x0 == 0 ? 0 : x0 - 1;
+      const size_t end_col = std::min(WORLD_X, x0 + count + 1);
+      // Bit i is column x0 + i - 1; anything off the grid counts as full
+      uint64_t outside = ~(uint64_t)0 << (end_col - x0 + 1);
+      if (x0 == 0) {
+        outside |= 1;
+      }
+      auto row_bits = [&](size_t row) {
+        return (OccupiedRun(row * WORLD_X + first_col, end_col - first_col) << (first_col + 1 - x0)) | outside;
+      };
+
+      for (size_t z = 0; z < CELL_LAYERS; z++) {
+        const size_t z_min = z == 0 ? 0 : z - 1;
+        const size_t z_max = std::min(CELL_LAYERS, z + 2);
+        for (size_t y = 0; y < WORLD_Y; y++) {
+          const uint64_t here = row_bits(z * WORLD_Y + y);
+          if (here == outside) {
+            continue; // No cells to be on the frontier
+          }
+          const size_t y_min = y == 0 ? 0 : y - 1;
+          const size_t y_max = std::min(WORLD_Y, y + 2);
+          uint64_t columns_full = here;
+          for (size_t nz = z_min; nz < z_max; nz++) {
+            for (size_t ny = y_min; ny < y_max; ny++) {
+              if (nz != z || ny != y) {
+                columns_full &= row_bits(nz * WORLD_Y + ny);
+              }
+            }
+          }
+          const uint64_t neighborhood_full = columns_full & (columns_full >> 1) & (columns_full << 1);
+          const uint64_t frontier = ((here & ~neighborhood_full) >> 1) & (((uint64_t)1 << count) - 1);
+
+          const size_t first = (z * WORLD_Y + y) * WORLD_X + x0;
+          const size_t shift = first % 64;
+          frontier_bits[first / 64] |= frontier << shift;
+          if (shift + count > 64) {
+            frontier_bits[first / 64 + 1] |= frontier >> (64 - shift);
+          }
+        }
+      }
+    }
+  }
+
+  /// Whether the cell at pos had an empty neighbor when UpdateFrontier()
+  /// last ran
+  bool IsFrontier(size_t pos) const {
+    return pos / 64 < frontier_bits.size() && (frontier_bits[pos / 64] >> (pos % 64) & 1);
+  }
+
+  /// Work out which positions are hypoxic, in one pass over the layers of
+  /// the oxygen grid cells live in rather than a lookup per cell
+  void UpdateHypoxia() {
+    oxygen->FindBelow(OXYGEN_THRESHOLD, hypoxic_bits, 0, CELL_LAYERS);
+  }
+
+  /// Whether pos had less than OXYGEN_THRESHOLD oxygen when UpdateHypoxia()
+  /// last ran
+  bool IsHypoxic(size_t pos) const {
+    return pos / 64 < hypoxic_bits.size() && (hypoxic_bits[pos / 64] >> (pos % 64) & 1);
+  }
+
+  /// Remove every cell
+  void Clear() {
+    emp::World<Cell>::Clear();
+    ResetOccupancy(occupied_slot.size());
+    survivors.resize(0);
+  }
+
+  /// One diffusion step: basal consumption by every occupied cell, diffusion
+  /// and oxygen inflow along the edge, all done in one sweep over the grid
   void UpdateOxygen() {
-      BasalOxygenConsumption();
-      oxygen->Diffuse();
-      oxygen->Update();
+      UpdateOxygenUptake();
+      oxygen->Step();
+  }
 
-      // Oxygen inflow along edge
-      for (size_t x = 0; x < WORLD_X; x++) {
-        oxygen->SetVal(x, 0, WORLD_Z-1, 1);
+  /// Bring oxygen forward by one time step with the configured solver
+  void DiffuseOxygen() {
+    // Cells don't change during diffusion, so which voxels consume oxygen
+    // only needs working out once
+    UpdateOxygenUptake();
+
+    if (OXYGEN_SOLVER == "steady") {
+      // Oxygen settles much faster than cells change, so skip straight
+      // to where it would settle given the current cells
+      diffusion_steps_taken = (int)oxygen->SolveSteadyState(STEADY_STATE_TOLERANCE, STEADY_STATE_MAX_CYCLES);
+    } else if (OXYGEN_SOLVER == "implicit") {
+      // Cover the same time as the explicit substeps in a few big steps
+      const int steps = std::max(1, IMPLICIT_DIFFUSION_STEPS);
+      for (int i = 0; i < steps; i++) {
+        oxygen->StepImplicit((double)DIFFUSION_STEPS_PER_TIME_STEP / steps);
+      }
+      diffusion_steps_taken = steps;
+    } else if (DIFFUSION_TIME_BLOCK > 1) {
+      // Same steps as UpdateOxygen, but several at a time per pass
+      diffusion_steps_taken = 0;
+      while (diffusion_steps_taken < DIFFUSION_STEPS_PER_TIME_STEP) {
+        const int steps = std::min(DIFFUSION_TIME_BLOCK, DIFFUSION_STEPS_PER_TIME_STEP - diffusion_steps_taken);
+        oxygen->StepBlocked(steps, DIFFUSION_TIME_BLOCK);
+        diffusion_steps_taken += steps;
+        if (OxygenSettled()) {
+          break;
+        }
+      }
+    } else {
+      diffusion_steps_taken = 0;
+      while (diffusion_steps_taken < DIFFUSION_STEPS_PER_TIME_STEP) {
+        oxygen->Step();
+        diffusion_steps_taken++;
+        if (OxygenSettled()) {
+          break;
+        }
       }
+    }
+  }
+
+  /// Whether diffusion can stop early this time step, because the last
+  /// step barely changed anything
+  bool OxygenSettled() const {
+    return DIFFUSION_TOLERANCE > 0 && diffusion_steps_taken >= MIN_DIFFUSION_STEPS
+           && oxygen->GetMaxChange() < DIFFUSION_TOLERANCE;
+  }
+
+  /// Flag every occupied cell as consuming oxygen, so diffusion can read a
+  /// mask instead of checking the population in every step
+  void UpdateOxygenUptake() {
+    oxygen->ClearUptake();
+    for (size_t cell_id : occupied_ids) {
+      oxygen->SetUptake(GetPosX(cell_id), GetPosY(cell_id), GetPosZ(cell_id), true);
+    }
   }
 
   void Reset(MemicConfig & config, bool web = false) {
@@ -233,14 +648,26 @@ class HCAWorld : public emp::World<Cell> {
     InitConfigs(config);
     oxygen.New(WORLD_X, WORLD_Y, WORLD_Z);
     oxygen->SetDiffusionCoefficient(OXYGEN_DIFFUSION_COEFFICIENT);
+    oxygen->SetThreads(DIFFUSION_THREADS);
+    oxygen->SetUptakeKinetics(BASAL_OXYGEN_CONSUMPTION, KM);
+    oxygen->SetSourceRow(0, WORLD_Z-1, 1); // Oxygen inflow along edge
+    if (AGENT_THREADS == 1) {
+      agent_pool = nullptr;
+    } else {
+      agent_pool = std::make_shared<ThreadPool>(AGENT_THREADS);
+    }
 
     if (!web) { // Web version needs to do diffusion separately to visualize
       OnUpdate([this](int ud){
-        for (int i = 0; i < DIFFUSION_STEPS_PER_TIME_STEP; i++) {
-          UpdateOxygen();
-        }
+        auto start = progress.StartPhase();
+        DiffuseOxygen();
+        progress.EndPhase("diffusion", start);
       });
     }
+    // After diffusion, which needs to see where the current cells are
+    OnUpdate([this](int ud){
+      CarryOverSurvivors();
+    });
 
     emp::Ptr<emp::Systematics<Cell, int> > sys;
     sys.New([](const Cell & c){return c.clade;});
@@ -265,14 +692,35 @@ class HCAWorld : public emp::World<Cell> {
 
     phylodiversity_file.PrintHeaderKeys();
     phylodiversity_file.SetTimingRepeat(config.DATA_RESOLUTION());
+
+    emp::DataFile & diffusion_file = SetupFile("diffusion.csv");
+    diffusion_file.AddVar(update, "generation", "Generation");
+    diffusion_file.AddVar(diffusion_steps_taken, "diffusion_steps", "Diffusion steps (or multigrid cycles) taken in the last time step");
+    diffusion_file.PrintHeaderKeys();
+    diffusion_file.SetTimingRepeat(config.DATA_RESOLUTION());
+
+    emp::DataFile & pool_file = SetupFile("cell_pool.csv");
+    pool_file.AddVar(update, "generation", "Generation");
+    pool_file.AddFun(pool_live_fun, "live_cells", "Cells allocated from the cell pool (across all worlds)");
+    pool_file.AddFun(pool_capacity_fun, "pool_capacity", "Cells the cell pool has room for without allocating more memory");
+    pool_file.PrintHeaderKeys();
+    pool_file.SetTimingRepeat(config.DATA_RESOLUTION());
     // emp::AddLineageMutationFile(*this, "lineage_mutations.csv", MUTATION_TYPES).SetTimingRepeat(config.DATA_RESOLUTION());
 
-    SetPopStruct_Grid(WORLD_X, WORLD_Y, true);
+    SetPopStruct_Grid(WORLD_X, WORLD_Y * CELL_LAYERS, true); // Layers stacked in y
+    if (CELL_LAYERS > 1) {
+      SetNeighborFuns3D();
+    }
+    ResetOccupancy(GetNumPositions());
     InitOxygen();
     InitPop();
 
     SetSynchronousSystematics(true);
 
+    if (PER_CELL_RANDOM) {
+      stream_seed = config.SEED() > 0 ? (uint64_t)config.SEED() : random_ptr->GetUInt();
+    }
+
     if (radiation_prescription_data.size() > 0) {
       next_radiation_time = radiation_prescription_data[0][0];
       next_radiation_index = 0;
@@ -280,14 +728,13 @@ class HCAWorld : public emp::World<Cell> {
   }
 
   void BasalOxygenConsumption() {
-    for (size_t cell_id = 0; cell_id < pop.size(); cell_id++) {
-      if (IsOccupied(cell_id)) {
-        size_t x = cell_id % WORLD_X;
-        size_t y = cell_id / WORLD_X;
-        double oxygen_loss_multiplier = oxygen->GetVal(x, y, 0);
-        oxygen_loss_multiplier /= oxygen_loss_multiplier + KM;
-        oxygen->DecNextVal(x, y, 0, BASAL_OXYGEN_CONSUMPTION * oxygen_loss_multiplier);
-      }
+    for (size_t cell_id : occupied_ids) {
+      size_t x = GetPosX(cell_id);
+      size_t y = GetPosY(cell_id);
+      size_t z = GetPosZ(cell_id);
+      double oxygen_loss_multiplier = oxygen->GetVal(x, y, z);
+      oxygen_loss_multiplier /= oxygen_loss_multiplier + KM;
+      oxygen->DecNextVal(x, y, z, BASAL_OXYGEN_CONSUMPTION * oxygen_loss_multiplier);
     }
   }
 
@@ -295,36 +742,68 @@ class HCAWorld : public emp::World<Cell> {
   /// Determine if cell can divide (i.e. is space available). If yes, return
   /// id of cell that it can divide into. If not, return -1.
   int CanDivide(size_t cell_id) {
-    emp::vector<int> open_spots;
-    int x_coord = (int)(cell_id % WORLD_X);
-    int y_coord = (int)(cell_id / WORLD_X);
-    
-    // Iterate over 9-cell neighborhood. Currently checks focal cell uneccesarily,
-    // but that shouldn't cause problems because it will never show up as invasible.
-    for (int x = std::max(0, x_coord-1); x < std::min((int)WORLD_X, x_coord + 2); x++) {
-      for (int y = std::max(0, y_coord-1); y < std::min((int)WORLD_Y, y_coord + 2); y++) {
-        int this_cell = y*(int)WORLD_X + x;
-        // Cells can be divided into if they are empty or if they are healthy and the
-        // dividing cell is cancerous
-        if (!IsOccupied((size_t)this_cell)) {
-          open_spots.push_back(this_cell);
-        }
+    return CanDivide(cell_id, *random_ptr);
+  }
+
+  /// As above, choosing among open spots with random
+  template <typename RANDOM>
+  int CanDivide(size_t cell_id, RANDOM & random) {
+    int x_coord = (int)GetPosX(cell_id);
+    int y_coord = (int)GetPosY(cell_id);
+    int z_coord = (int)GetPosZ(cell_id);
+    const int x_min = std::max(0, x_coord-1);
+    const int x_max = std::min((int)WORLD_X, x_coord + 2);
+    const int y_min = std::max(0, y_coord-1);
+    const int y_max = std::min((int)WORLD_Y, y_coord + 2);
+    const int z_min = std::max(0, z_coord-1);
+    const int z_max = std::min((int)CELL_LAYERS, z_coord + 2);
+
+    // Occupancy of the 9-cell neighborhood (27-cell in 3D), one row of bits
+    // per y and z. Currently includes the focal cell uneccesarily, but that
+    // shouldn't cause problems because it will never show up as invasible.
+    const uint64_t full_row = ((uint64_t)1 << (x_max - x_min)) - 1;
+    uint64_t rows[3][3];
+    bool any_open = false;
+    for (int z = z_min; z < z_max; z++) {
+      for (int y = y_min; y < y_max; y++) {
+        rows[z - z_min][y - y_min] = OccupiedRun((size_t)((z*(int)WORLD_Y + y)*(int)WORLD_X + x_min), (size_t)(x_max - x_min));
+        any_open |= rows[z - z_min][y - y_min] != full_row;
       }
     }
-    
-    // -1 is a sentinel value indicating no spots are available
-    if (open_spots.size() == 0) {
+    if (!any_open) {
+      // -1 is a sentinel value indicating no spots are available
       return -1;
     }
 
+    // At most 26 spots, so they fit on the stack (this runs for every
+    // living cell every update)
+    int open_spots[27];
+    size_t num_open = 0;
+    for (int x = x_min; x < x_max; x++) {
+      for (int y = y_min; y < y_max; y++) {
+        for (int z = z_min; z < z_max; z++) {
+          // Cells can be divided into if they are empty or if they are healthy and the
+          // dividing cell is cancerous
+          if (!(rows[z - z_min][y - y_min] >> (x - x_min) & 1)) {
+            open_spots[num_open++] = (z*(int)WORLD_Y + y)*(int)WORLD_X + x;
+          }
+        }
+      }
+    }
+
     // If there are one or more available spaces, return a random spot
-    return open_spots[random_ptr->GetUInt(0, open_spots.size())];
+    return open_spots[random.GetUInt(0, num_open)];
   }
 
   int Mutate(emp::Ptr<Cell> c){
+    return Mutate(c, random_ptr->P(NEUTRAL_MUTATION_RATE));
+  }
+
+  /// Mutate a newborn cell, where whether it's a mutant has already been decided
+  int Mutate(emp::Ptr<Cell> c, bool mutant){
     c->age = 0;
     
-    if (random_ptr->P(NEUTRAL_MUTATION_RATE)) {
+    if (mutant) {
       c->clade = next_clade;
       next_clade++;
       return 1;
@@ -336,17 +815,136 @@ class HCAWorld : public emp::World<Cell> {
 
   void Quiesce(size_t cell_id) {
     // Quiescence - stick the cell back into the population in
-    // the same spot but don't change anything else
+    // the same spot but don't change anything else. The cell itself
+    // moves into the next generation once this one is over, rather
+    // than being copied.
     // std::cout << "Quieseing" << std::endl;
+    if (GrowOlder(cell_id)) {
+      survivors.push_back(cell_id);
+    }
+  }
+
+  /// Age a cell by one update; returns whether it's still young enough to live
+  bool GrowOlder(size_t cell_id) {
     pop[cell_id]->age++;
-    if (pop[cell_id]->age < AGE_LIMIT) {
-      emp::Ptr<Cell> cell = emp::NewPtr<Cell>(*pop[cell_id]);
-      AddOrgAt(cell, emp::WorldPosition(cell_id,1), cell_id);      
+    return pop[cell_id]->age < AGE_LIMIT;
+  }
+
+  /// Move quiescent cells into the next generation as they are. Done once
+  /// the generation is over, so they stay in place while it's being updated.
+  void CarryOverSurvivors() {
+    if (survivors.size() && pops[1].size() < pop.size()) {
+      pops[1].resize(pop.size());
     }
+    for (size_t cell_id : survivors) {
+      if (!IsOccupied(cell_id)) {
+        continue;
+      }
+      const emp::WorldPosition active_pos(cell_id);
+      const emp::WorldPosition next_pos(cell_id, 1);
+      RemoveOrgAt(next_pos);
+
+      // Systematics are told the same as when quiescent cells were copied:
+      // a new cell of the same taxon in the next generation, then the
+      // death of the old one. That keeps taxon counts (e.g. total
+      // organisms) as they were, which a plain Swap() would not.
+      for (auto s : systematics) {
+        s->SetNextParent((int)cell_id);
+        s->AddOrg(*pop[cell_id], next_pos, (int)update);
+      }
+      on_death_sig.Trigger(cell_id);
+      pops[1][cell_id] = pop[cell_id];
+      pop[cell_id] = nullptr;
+      --num_orgs;
+      for (auto s : systematics) {
+        s->RemoveOrg(active_pos);
+      }
+    }
+    survivors.resize(0);
+  }
+
+  /// Work out what each living cell in [first_cell, end_cell) does this
+  /// update, drawing from random (or each cell's own stream). Only changes
+  /// the cells themselves (their age and hif1-alpha), so separate ranges
+  /// can be decided in parallel.
+  void DecideFates(size_t first_cell, size_t end_cell, emp::Random & random, emp::vector<CellFate> & fates) {
+    fates.resize(0);
+    // Only visit living cells; none of them move until Update()
+    for (size_t cell_id = NextOccupied(first_cell); cell_id < end_cell; cell_id = NextOccupied(cell_id + 1)) {
+      if (PER_CELL_RANDOM) {
+        CounterRandom cell_random(stream_seed, (uint32_t)cell_id, (uint32_t)update, FATE_STREAM);
+        DecideFate(cell_id, cell_random, fates);
+      } else {
+        DecideFate(cell_id, random, fates);
+      }
+    }
+  }
+
+  /// Work out what the living cell at cell_id does this update
+  template <typename RANDOM>
+  void DecideFate(size_t cell_id, RANDOM & random, emp::vector<CellFate> & fates) {
+    // Query oxygen to test for hypoxia
+    if (IsHypoxic(cell_id)) {
+      // If hypoxic, the hif1-alpha surpressor gets turned off
+      // causing hif1-alpha to accumulate
+      pop[cell_id]->hif1alpha = 1;
+
+      // If hypoxic, die with specified probability
+      if (!random.P(HYPOXIA_DEATH_PROB) && GrowOlder(cell_id)) {
+        fates.push_back({cell_id, -1, {false, false}});
+      }
+      return; // Division not allowed under hypoxia 
+      // TODO: Consider replacing this with a function relating
+      // division probability to oxygen availability, as in 
+      // Grimes et al 2018
+    } else {
+      // If not hypoxic, the hif1-alpha surpressor is on
+      // causing hif1-alpha to not accumulate
+      pop[cell_id]->hif1alpha = 0;
+    }
+
+    // Check for space for division (cells off the frontier have none)
+    int potential_offspring_cell = IsFrontier(cell_id) ? CanDivide(cell_id, random) : -1;
+
+    // If space, divide
+    if (potential_offspring_cell != -1 && random.P(MITOSIS_PROB)) {
+      // Check if cell needs to die
+      if (pop[cell_id]->marked_for_death) {
+        return;
+      }
+      const bool first_mutant = random.P(NEUTRAL_MUTATION_RATE);
+      const bool second_mutant = random.P(NEUTRAL_MUTATION_RATE);
+      fates.push_back({cell_id, potential_offspring_cell, {first_mutant, second_mutant}});
+    } else if (GrowOlder(cell_id)) {
+      fates.push_back({cell_id, -1, {false, false}});
+    }
+  }
+
+  /// Cell divides, into offspring_cell and its own spot
+  void Divide(size_t cell_id, size_t offspring_cell, const bool mutant[2]) {
+    oxygen->DecNextVal(GetPosX(cell_id), GetPosY(cell_id), GetPosZ(cell_id), OXYGEN_CONSUMPTION_DIVISION);
+
+    // Handle daughter cell in previously empty spot
+    before_repro_sig.Trigger(cell_id);
+    emp::Ptr<Cell> offspring = emp::NewPtr<Cell>(*pop[cell_id]);
+    Mutate(offspring, mutant[0]);
+    offspring_ready_sig.Trigger(*offspring, cell_id);
+    AddOrgAt(offspring, emp::WorldPosition(offspring_cell, 1), cell_id);
+
+    // Handle daughter cell in current location
+    before_repro_sig.Trigger(cell_id);
+    offspring = emp::NewPtr<Cell>(*pop[cell_id]);
+    Mutate(offspring, mutant[1]);
+    offspring_ready_sig.Trigger(*offspring, cell_id);
+    AddOrgAt(offspring, emp::WorldPosition(cell_id,1), cell_id);
+  }
+
+  ProgressReporter & GetProgress() {
+    return progress;
   }
 
   void RunStep() {
-    std::cout << update << std::endl;
+    auto start = progress.StartPhase();
 
     if ((int)update == next_radiation_time) {
       // Do radiation
@@ -362,78 +960,62 @@ class HCAWorld : public emp::World<Cell> {
       }
     }
 
-    for (size_t cell_id = 0; cell_id < WORLD_X * WORLD_Y; cell_id++) {
-      if (!IsOccupied(cell_id)) {
-        // Don't need to do anything for dead/empty cells
-        continue;
-      }
-
-      size_t x = cell_id % WORLD_X;
-      size_t y = cell_id / WORLD_X;
-
-      // Query oxygen to test for hypoxia
-      if (oxygen->GetVal(x, y, 0) < OXYGEN_THRESHOLD) {
-        // If hypoxic, the hif1-alpha surpressor gets turned off
-        // causing hif1-alpha to accumulate
-        pop[cell_id]->hif1alpha = 1;
-
-        // If hypoxic, die with specified probability
-        if (!random_ptr->P(HYPOXIA_DEATH_PROB)) {
-          Quiesce(cell_id); // Cell survives to next generation
+    UpdateFrontier();
+    UpdateHypoxia();
+
+    // Decide what every cell does, then do it. Deciding only looks at the
+    // current generation and changes nothing but the cell itself, so bands
+    // of rows can be decided at the same time.
+    if (agent_pool) {
+      const size_t num_rows = WORLD_Y * CELL_LAYERS; // Rows of every layer, one after another
+      const size_t num_bands = (num_rows + AGENT_BAND_ROWS - 1) / AGENT_BAND_ROWS;
+      const size_t num_threads = agent_pool->GetNumThreads();
+      band_random.resize(num_bands);
+      band_fates.resize(num_bands);
+      if (!PER_CELL_RANDOM) {
+        for (emp::Random & random : band_random) {
+          random.ResetSeed((int)random_ptr->GetUInt(2147483646u) + 1);
         }
-        continue; // Division not allowed under hypoxia 
-        // TODO: Consider replacing this with a function relating
-        // division probability to oxygen availability, as in 
-        // Grimes et al 2018
-      } else {
-        // If not hypoxic, the hif1-alpha surpressor is on
-        // causing hif1-alpha to not accumulate
-        pop[cell_id]->hif1alpha = 0;
       }
+      agent_pool->Run([this, num_rows, num_bands, num_threads](size_t thread_id){
+        for (size_t band = thread_id; band < num_bands; band += num_threads) {
+          const size_t end_row = std::min(num_rows, (band + 1) * AGENT_BAND_ROWS);
+          DecideFates(band * AGENT_BAND_ROWS * WORLD_X, end_row * WORLD_X, band_random[band], band_fates[band]);
+        }
+      });
+    } else {
+      band_fates.resize(1);
+      DecideFates(0, GetNumPositions(), *random_ptr, band_fates[0]);
+    }
 
-      // Check for space for division
-      int potential_offspring_cell = CanDivide(cell_id);
-
-      // If space, divide
-      if (potential_offspring_cell != -1 && random_ptr->P(MITOSIS_PROB)) {
-        // Check if cell needs to die
-        if (pop[cell_id]->marked_for_death) {
-          continue;
+    for (const emp::vector<CellFate> & fates : band_fates) {
+      for (const CellFate & fate : fates) {
+        if (fate.offspring_cell == -1) {
+          survivors.push_back(fate.cell_id); // Cell survives to next generation
+        } else {
+          Divide(fate.cell_id, (size_t)fate.offspring_cell, fate.mutant);
         }
-        
-        // Cell divides
-        oxygen->DecNextVal(x, y, 0, OXYGEN_CONSUMPTION_DIVISION);
-
-        // Handle daughter cell in previously empty spot
-        before_repro_sig.Trigger(cell_id);
-        emp::Ptr<Cell> offspring = emp::NewPtr<Cell>(*pop[cell_id]);
-        Mutate(offspring);
-        offspring_ready_sig.Trigger(*offspring, cell_id);
-        AddOrgAt(offspring, emp::WorldPosition((size_t)potential_offspring_cell, 1), cell_id);
-
-        // Handle daughter cell in current location
-        before_repro_sig.Trigger(cell_id);
-        offspring = emp::NewPtr<Cell>(*pop[cell_id]);
-        Mutate(offspring);
-        offspring_ready_sig.Trigger(*offspring, cell_id);
-        AddOrgAt(offspring, emp::WorldPosition(cell_id,1), cell_id);
-        // std::cout << "Mutated: " << offspring->clade << std::endl;
-      } else {        
-        Quiesce(cell_id);
       }
     }
+    progress.EndPhase("cells", start);
 
     Update();
+    progress.Update(update, GetNumOrgs());
   }
 
   void Run() {
+      progress.Start(update + TIME_STEPS + 1, update);
       for (int u = 0; u <= TIME_STEPS; u++) {
           RunStep();
       }
       PrintOxygenGrid("oxygen.csv");
       systematics[0].DynamicCast<emp::Systematics<Cell, int>>()->Snapshot("memic_phylo.csv");  
-      densities = emp::GridDensity(*this);
-      std::cout << emp::to_string(densities) << std::endl;
+      // GridDensity() sees the world as one grid, which in 3D is the
+      // layers stacked in y, so it would count neighbors across layers wrong
+      if (CELL_LAYERS == 1) {
+        densities = emp::GridDensity(*this);
+        std::cout << emp::to_string(densities) << std::endl;
+      }
 
   }
 
@@ -444,20 +1026,61 @@ class HCAWorld : public emp::World<Cell> {
     return exp(-n*(alpha*d + beta*emp::Pow(d,2)));
   }
 
-  /* n is the number of doses of radiation, d dose size in Gy*/
-  void ApplyRadiation(double n, double d) {
-    for (size_t cell_id = 0; cell_id < WORLD_X * WORLD_Y; cell_id++) {
-      if (!IsOccupied(cell_id)) {
-        // Don't need to do anything for dead/empty cells
-        continue;
+  /// SurvivingFraction() against oxygen level c for n doses of d Gy,
+  /// tabulated the first time a dose is asked for. Outside the usual range
+  /// of oxygen levels it falls back on SurvivingFraction() itself. Values
+  /// are within the table's GetMaxError() (about 1e-8) of the formula.
+  const LookupTable & GetDoseTable(double n, double d) {
+    for (const DoseTable & dose : dose_tables) {
+      if (dose.n == n && dose.d == d) {
+        return dose.table;
       }
+    }
+    const double max_oxygen = std::max(1.0, INITIAL_OXYGEN_LEVEL);
+    dose_tables.push_back({n, d, LookupTable([this, n, d](double c){return SurvivingFraction(n, d, c);}, 0, max_oxygen)});
+    return dose_tables.back().table;
+  }
 
-      size_t x = cell_id % WORLD_X;
-      size_t y = cell_id / WORLD_X;
-      double c = oxygen->GetVal(x, y, 0);
+  /// SurvivingFraction(n, d, c), from the table for the dose
+  double LookupSurvivingFraction(double n, double d, double c) {
+    return GetDoseTable(n, d)(c);
+  }
 
+  /// Whether a cell at oxygen level c survives n doses of d Gy: the same
+  /// draw, with the same answer, as random.P(SurvivingFraction(n, d, c)).
+  /// The table settles it unless the draw lands within the table's error
+  /// of its value, which is when the formula is worked out; copies of
+  /// random look at the same draw again.
+  template <typename RANDOM>
+  bool DrawSurvival(RANDOM & random, const LookupTable & surviving_fraction, double n, double d, double c) {
+    const double p = surviving_fraction(c);
+    const double error = surviving_fraction.GetMaxError();
+    RANDOM same_draw = random;
+    if (random.P(p - error)) {
+      return true;
+    }
+    RANDOM exact_draw = same_draw;
+    if (!same_draw.P(p + error)) {
+      return false;
+    }
+    return exact_draw.P(SurvivingFraction(n, d, c));
+  }
 
-      if (!random_ptr->P(SurvivingFraction(n,d,c))) {
+  /* n is the number of doses of radiation, d dose size in Gy*/
+  void ApplyRadiation(double n, double d) {
+    const LookupTable & surviving_fraction = GetDoseTable(n, d);
+    for (size_t cell_id = NextOccupied(0); cell_id < GetNumPositions(); cell_id = NextOccupied(cell_id + 1)) {
+      double c = oxygen->GetVal(GetPosX(cell_id), GetPosY(cell_id), GetPosZ(cell_id));
+
+      bool survives;
+      if (PER_CELL_RANDOM) {
+        CounterRandom cell_random(stream_seed, (uint32_t)cell_id, (uint32_t)update, RADIATION_STREAM);
+        survives = DrawSurvival(cell_random, surviving_fraction, n, d, c);
+      } else {
+        survives = DrawSurvival(*random_ptr, surviving_fraction, n, d, c);
+      }
+
+      if (!survives) {
         // TODO: Figure out best way to kill cells
         pop[cell_id]->marked_for_death = true;
       } 
@@ -465,18 +1088,24 @@ class HCAWorld : public emp::World<Cell> {
     }
   }
 
+  /// Oxygen levels under the cells, one row of the grid per line. In 3D
+  /// each layer of cells gets its own grid, with a blank line before it.
   void PrintOxygenGrid(const std::string & filename) const {
 
     std::ofstream oxygen_file(filename);
 
-    for (size_t cell_id = 0; cell_id < WORLD_X * WORLD_Y; cell_id++) {
-      size_t x = cell_id % WORLD_X;
-      size_t y = cell_id / WORLD_X;
+    for (size_t cell_id = 0; cell_id < GetNumPositions(); cell_id++) {
+      size_t x = GetPosX(cell_id);
+      size_t y = GetPosY(cell_id);
+      size_t z = GetPosZ(cell_id);
+      if (x == 0 && y == 0 && z > 0) {
+        oxygen_file << "\n"; // Blank line between layers
+      }
       if (x % WORLD_X > 0 ) {
         oxygen_file << ", "; // Don't add comma at beginning of line
       }
 
-      oxygen_file << emp::to_string(oxygen->GetVal(x, y, 0));
+      oxygen_file << emp::to_string(oxygen->GetVal(x, y, z));
 
       if (x % WORLD_X == WORLD_X - 1 ) {
         oxygen_file << "\n"; // We're at the end of a row
@@ -487,4 +1116,6 @@ class HCAWorld : public emp::World<Cell> {
   }
 };
 
-#endif
\ No newline at end of file
+using HCAWorld = HCAWorldT<>;
+
+#endif
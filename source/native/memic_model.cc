@@ -1,11 +1,21 @@
 // This is the main function for the NATIVE version of this project.
 
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
 #include "../memic_model.h"
 #include "base/vector.h"
 #include "config/command_line.h"
 
+template <typename GRADIENT>
+void RunWorld(MemicConfig & config, emp::Random & rnd) {
+  HCAWorldT<GRADIENT> world(rnd);
+  world.Setup(config);
+
+  world.Run();
+}
+
 int main(int argc, char* argv[])
 {
   MemicConfig config;
@@ -22,8 +32,19 @@ int main(int argc, char* argv[])
 
   emp::Random rnd(config.SEED());
 
-  HCAWorld world(rnd);
-  world.Setup(config);
-
-  world.Run();
+  // Settings the model can't run with are reported when the world is set up
+  try {
+    if (config.OXYGEN_PRECISION() == "float") {
+      RunWorld<ResourceGradientT<float> >(config, rnd);
+    } else if (config.OXYGEN_PRECISION() == "mixed") {
+      RunWorld<ResourceGradientT<float, double> >(config, rnd);
+    } else if (config.OXYGEN_PRECISION() == "double") {
+      RunWorld<ResourceGradient>(config, rnd);
+    } else {
+      throw std::invalid_argument("OXYGEN_PRECISION must be double, float or mixed, not \"" + config.OXYGEN_PRECISION() + "\"");
+    }
+  } catch (const std::invalid_argument & error) {
+    std::cerr << "Error: " << error.what() << std::endl;
+    return 1;
+  }
 }
@@ -75,6 +75,11 @@ class HCAWebInterface : public UI::Animate, public HCAWorld{
                                         return emp::ColorHSL(hue,50,50);
                                      };
 
+  color_fun_t hypoxia_color_fun = [this](int cell_id) {
+                                        double hue = IsHypoxic(cell_id) * 280.0;
+                                        return emp::ColorHSL(hue,50,50);
+                                     };
+
   color_fun_t death_color_fun = [this](int cell_id) {
                                         double hue = pop[cell_id]->marked_for_death * 280.0;
                                         return emp::ColorHSL(hue,50,50);
@@ -92,7 +97,7 @@ class HCAWebInterface : public UI::Animate, public HCAWorld{
 
   color_fun_t sf_color_fun = [this](int cell_id) {
                                         double c = oxygen->GetVal(cell_id % WORLD_X, cell_id / WORLD_X, 0);
-                                        double hue = emp::Pow(SurvivingFraction(RADIATION_DOSES, RADIATION_DOSE_SIZE, c), .25) * 280.0;
+                                        double hue = emp::Pow(LookupSurvivingFraction(RADIATION_DOSES, RADIATION_DOSE_SIZE, c), .25) * 280.0;
                                         return emp::ColorHSL(hue,50,50);
                                      };
 
@@ -168,6 +173,10 @@ class HCAWebInterface : public UI::Animate, public HCAWorld{
 
     cell_color_control.SetOption("Cell density heat map", 
                                  [this](){
+                                     // GridDensity() sees 3D layers stacked in y, so it's 2D only
+                                     if (GetCellLayers() != 1) {
+                                         return;
+                                     }
                                      densities = emp::GridDensity(*this);
                                      OnUpdate([this](int ud){densities = emp::GridDensity(*this);});
                                      cell_color_fun = density_color_fun;
@@ -177,6 +186,10 @@ class HCAWebInterface : public UI::Animate, public HCAWorld{
 
     cell_color_control.SetOption("Shannon diversity heat map", 
                                  [this](){
+                                     // GridShannonEntropy() sees 3D layers stacked in y, so it's 2D only
+                                     if (GetCellLayers() != 1) {
+                                         return;
+                                     }
                                      diversities = emp::GridShannonEntropy(*this);
                                      OnUpdate([this](int ud){diversities = emp::GridShannonEntropy(*this);});
                                      cell_color_fun = shannon_entropy_color_fun;
@@ -198,6 +211,13 @@ class HCAWebInterface : public UI::Animate, public HCAWorld{
                                      RedrawCells();
                                  }, 7);
 
+    cell_color_control.SetOption("Hypoxic region", 
+                                 [this](){
+                                     cell_color_fun = hypoxia_color_fun;
+                                     should_draw_cell_fun = always_draw;
+                                     RedrawCells();
+                                 }, 8);
+
     toggle = GetToggleButton("but_toggle");
     button_style.AddClass("btn");
     button_style.AddClass("btn-primary");
@@ -231,6 +251,20 @@ class HCAWebInterface : public UI::Animate, public HCAWorld{
     config_ui.ExcludeConfig("WORLD_X");
     config_ui.ExcludeConfig("WORLD_Y");
     config_ui.ExcludeConfig("DATA_RESOLUTION");
+    config_ui.ExcludeConfig("PROGRESS_INTERVAL");
+    config_ui.ExcludeConfig("PROGRESS_FORMAT");
+    config_ui.ExcludeConfig("DIFFUSION_THREADS");
+    config_ui.ExcludeConfig("AGENT_THREADS");
+    config_ui.ExcludeConfig("RANDOM_STREAMS");
+    config_ui.ExcludeConfig("CELL_DIMENSIONS");
+    config_ui.ExcludeConfig("DIFFUSION_TIME_BLOCK");
+    config_ui.ExcludeConfig("OXYGEN_SOLVER");
+    config_ui.ExcludeConfig("IMPLICIT_DIFFUSION_STEPS");
+    config_ui.ExcludeConfig("STEADY_STATE_TOLERANCE");
+    config_ui.ExcludeConfig("STEADY_STATE_MAX_CYCLES");
+    config_ui.ExcludeConfig("OXYGEN_PRECISION");
+    config_ui.ExcludeConfig("DIFFUSION_TOLERANCE");
+    config_ui.ExcludeConfig("MIN_DIFFUSION_STEPS");
     config_ui.Setup();
     controls << config_ui.GetDiv();
 
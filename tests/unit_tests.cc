@@ -1,4 +1,13 @@
 #define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
 #include "catch.hpp"
 #include "../source/ResourceGradient.h"
 #include "../source/memic_model.h"
@@ -43,6 +52,33 @@ TEST_CASE("Test constructor", "[oxygen_gradient]") {
             CHECK(r2.GetVal(x, y, 0) == x*x+y);
         }
     }
+
+    // Importing a 3D grid should keep every voxel in its own slot
+    // of the flat buffer
+    grid_z = 4;
+    grid.resize(grid_z);
+    for (size_t z = 0; z < grid_z; z++) {
+        grid[z].resize(grid_y);
+        for (size_t y = 0; y < grid_y; y++) {
+            grid[z][y].resize(grid_x);
+            for (size_t x = 0; x < grid_x; x++) {
+                grid[z][y][x] = x + 10*y + 100*z;
+            }
+        }
+    }
+
+    ResourceGradient r3(grid);
+    CHECK(r3.GetXLen() == grid_x);
+    CHECK(r3.GetYLen() == grid_y);
+    CHECK(r3.GetZLen() == grid_z);
+    for (size_t z = 0; z < grid_z; z++) {
+        for (size_t y = 0; y < grid_y; y++) {
+            for (size_t x = 0; x < grid_x; x++) {
+                CHECK(r3.GetVal(x, y, z) == x + 10*y + 100*z);
+                CHECK(r3.GetNextVal(x, y, z) == 0);
+            }
+        }
+    }
 }
 
 TEST_CASE("Test standard diffusion", "[oxygen_gradient]") {
@@ -205,6 +241,659 @@ TEST_CASE("Test Z axis", "[oxygen_gradient]") {
     CHECK(Approx(r.GetNeighborOxygen(0,2,3)) == 2);
 }
 
+TEST_CASE("Test diffusion kernels", "[oxygen_gradient]") {
+    // Every kernel this CPU supports should give exactly the same
+    // answer as applying the stencil voxel by voxel
+    emp::Random random(1);
+    for (bool toroidal : {false, true}) {
+        ResourceGradient r(13, 7, 5);
+        r.SetDiffusionCoefficient(.1);
+        r.SetToroidal(toroidal);
+        for (size_t z = 0; z < 5; z++) {
+            for (size_t y = 0; y < 7; y++) {
+                for (size_t x = 0; x < 13; x++) {
+                    r.SetVal(x, y, z, random.GetDouble());
+                }
+            }
+        }
+
+        for (auto & kernel : diffusion_kernels::AvailableKernels()) {
+            INFO("Kernel: " << kernel.first << " toroidal: " << toroidal);
+            ResourceGradient r_kernel(r);
+            r_kernel.SetRowKernel(kernel.second);
+            r_kernel.Diffuse();
+            for (size_t z = 0; z < 5; z++) {
+                for (size_t y = 0; y < 7; y++) {
+                    for (size_t x = 0; x < 13; x++) {
+                        double expected = r.GetVal(x, y, z) + (.1 * (r.GetNeighborOxygen(x, y, z) - (6.0 * r.GetVal(x, y, z))));
+                        CHECK(r_kernel.GetNextVal(x, y, z) == expected);
+                    }
+                }
+            }
+        }
+
+        // A single z-layer uses the 5-point stencil instead
+        ResourceGradient flat(13, 7, 1);
+        flat.SetDiffusionCoefficient(.1);
+        flat.SetToroidal(toroidal);
+        CHECK(flat.IsPlanar());
+        for (size_t y = 0; y < 7; y++) {
+            for (size_t x = 0; x < 13; x++) {
+                flat.SetVal(x, y, 0, random.GetDouble());
+            }
+        }
+        for (auto & kernel : diffusion_kernels::AvailableKernels(2)) {
+            INFO("Planar kernel: " << kernel.first << " toroidal: " << toroidal);
+            ResourceGradient r_kernel(flat);
+            r_kernel.SetPlanarRowKernel(kernel.second);
+            r_kernel.Diffuse();
+            for (size_t y = 0; y < 7; y++) {
+                for (size_t x = 0; x < 13; x++) {
+                    auto neighbor = [&](size_t pos, size_t len, bool up){
+                        if (up) {
+                            return pos + 1 < len ? pos + 1 : (toroidal ? 0 : pos);
+                        }
+                        return pos > 0 ? pos - 1 : (toroidal ? len - 1 : pos);
+                    };
+                    const double c = flat.GetVal(x, y, 0);
+                    const double neighbors = flat.GetVal(neighbor(x, 13, false), y, 0) + flat.GetVal(neighbor(x, 13, true), y, 0)
+                                           + flat.GetVal(x, neighbor(y, 7, false), 0) + flat.GetVal(x, neighbor(y, 7, true), 0);
+                    CHECK(r_kernel.GetNextVal(x, y, 0) == c + (.1 * (neighbors - (4.0 * c))));
+                    // Same as the 7-point stencil with z mirrored, up to rounding
+                    CHECK(r_kernel.GetNextVal(x, y, 0) == Approx(c + (.1 * (flat.GetNeighborOxygen(x, y, 0) - (6.0 * c)))).epsilon(1e-14));
+                }
+            }
+        }
+    }
+
+    // Fixed values above or below a single layer still pull on it
+    ResourceGradient capped(13, 7, 1);
+    capped.SetBoundary(ResourceGradient::Z_HIGH, ResourceGradient::Boundary::DIRICHLET, 1);
+    CHECK(!capped.IsPlanar());
+}
+
+TEST_CASE("Test boundary policies", "[oxygen_gradient]") {
+    // Periodic in x, fixed values below in y and z, no-flux above
+    emp::Random random(2);
+    ResourceGradient r(13, 7, 5);
+    r.SetDiffusionCoefficient(.1);
+    r.SetBoundary(ResourceGradient::X_LOW, ResourceGradient::Boundary::PERIODIC);
+    r.SetBoundary(ResourceGradient::Y_LOW, ResourceGradient::Boundary::DIRICHLET, .7);
+    r.SetBoundary(ResourceGradient::Z_LOW, ResourceGradient::Boundary::DIRICHLET, .2);
+    CHECK(r.GetBoundary(ResourceGradient::X_HIGH) == ResourceGradient::Boundary::PERIODIC);
+    CHECK(r.GetBoundary(ResourceGradient::Y_HIGH) == ResourceGradient::Boundary::NO_FLUX);
+    CHECK(r.GetBoundaryValue(ResourceGradient::Y_LOW) == .7);
+    for (size_t z = 0; z < 5; z++) {
+        for (size_t y = 0; y < 7; y++) {
+            for (size_t x = 0; x < 13; x++) {
+                r.SetVal(x, y, z, random.GetDouble());
+            }
+        }
+    }
+    CHECK(r.GetNeighborOxygen(0, 0, 0) == r.GetVal(12, 0, 0) + r.GetVal(1, 0, 0) + .7 + r.GetVal(0, 1, 0) + .2 + r.GetVal(0, 0, 1));
+    CHECK(r.GetNeighborOxygen(12, 6, 4) == r.GetVal(11, 6, 4) + r.GetVal(0, 6, 4) + r.GetVal(12, 5, 4) + r.GetVal(12, 6, 4)
+                                           + r.GetVal(12, 6, 3) + r.GetVal(12, 6, 4));
+
+    for (auto & kernel : diffusion_kernels::AvailableKernels()) {
+        INFO("Kernel: " << kernel.first);
+        ResourceGradient r_kernel(r);
+        r_kernel.SetRowKernel(kernel.second);
+        r_kernel.Diffuse();
+        for (size_t z = 0; z < 5; z++) {
+            for (size_t y = 0; y < 7; y++) {
+                for (size_t x = 0; x < 13; x++) {
+                    double expected = r.GetVal(x, y, z) + (.1 * (r.GetNeighborOxygen(x, y, z) - (6.0 * r.GetVal(x, y, z))));
+                    CHECK(r_kernel.GetNextVal(x, y, z) == expected);
+                }
+            }
+        }
+    }
+
+    // Temporal blocking handles the same faces identically
+    r.SetUptakeKinetics(.02, .01);
+    r.SetUptake(3, 0, 0, true);
+    r.SetUptake(0, 6, 4, true);
+    for (size_t threads : {1, 2}) {
+        ResourceGradient stepped(r);
+        ResourceGradient blocked(r);
+        blocked.SetThreads(threads);
+        for (int i = 0; i < 7; i++) {
+            stepped.Step();
+        }
+        blocked.StepBlocked(7, 3);
+        for (size_t z = 0; z < 5; z++) {
+            for (size_t y = 0; y < 7; y++) {
+                for (size_t x = 0; x < 13; x++) {
+                    CHECK(blocked.GetVal(x, y, z) == stepped.GetVal(x, y, z));
+                }
+            }
+        }
+    }
+
+    // Implicit steps follow explicit ones closely (splitting error is
+    // larger next to fixed-value faces, so these steps are shorter)
+    ResourceGradient explicit_steps(r);
+    ResourceGradient implicit_steps(r);
+    for (int i = 0; i < 500; i++) {
+        explicit_steps.Step();
+        implicit_steps.StepImplicit(1);
+    }
+    for (size_t z = 0; z < 5; z++) {
+        for (size_t y = 0; y < 7; y++) {
+            for (size_t x = 0; x < 13; x++) {
+                CHECK(implicit_steps.GetVal(x, y, z) == Approx(explicit_steps.GetVal(x, y, z)).margin(.01));
+            }
+        }
+    }
+
+    // And the steady state is where they settle
+    ResourceGradient steady(r);
+    steady.SolveSteadyState(1e-14, 100);
+    for (int i = 0; i < 20000; i++) {
+        explicit_steps.Step();
+    }
+    for (size_t z = 0; z < 5; z++) {
+        for (size_t y = 0; y < 7; y++) {
+            for (size_t x = 0; x < 13; x++) {
+                CHECK(steady.GetVal(x, y, z) == Approx(explicit_steps.GetVal(x, y, z)).margin(1e-10));
+            }
+        }
+    }
+
+    // With every face held at the same value, that's where everything ends up
+    ResourceGradient closed(6, 5, 3);
+    closed.SetDiffusionCoefficient(.1);
+    for (size_t face = 0; face < 6; face++) {
+        closed.SetBoundary((ResourceGradient::Face) face, ResourceGradient::Boundary::DIRICHLET, .3);
+    }
+    closed.SetVal(2, 2, 1, 5);
+    ResourceGradient closed_steady(closed);
+    closed.StepImplicit(1e9);
+    closed_steady.SolveSteadyState(1e-14, 100);
+    for (size_t z = 0; z < 3; z++) {
+        for (size_t y = 0; y < 5; y++) {
+            for (size_t x = 0; x < 6; x++) {
+                CHECK(closed.GetVal(x, y, z) == Approx(.3));
+                CHECK(closed_steady.GetVal(x, y, z) == Approx(.3));
+            }
+        }
+    }
+}
+
+TEST_CASE("Test multithreaded diffusion", "[oxygen_gradient]") {
+    // Splitting the grid into slabs across threads should not change
+    // a single bit of the result
+    emp::Random random(2);
+    for (bool toroidal : {false, true}) {
+        ResourceGradient serial(64, 64, 10);
+        serial.SetDiffusionCoefficient(.1);
+        serial.SetToroidal(toroidal);
+        for (size_t z = 0; z < 10; z++) {
+            for (size_t y = 0; y < 64; y++) {
+                for (size_t x = 0; x < 64; x++) {
+                    serial.SetVal(x, y, z, random.GetDouble() - .1);
+                }
+            }
+        }
+
+        ResourceGradient parallel(serial);
+        parallel.SetThreads(4);
+        CHECK(parallel.GetThreads() == 4);
+        CHECK(serial.GetThreads() == 1);
+
+        for (int step = 0; step < 3; step++) {
+            serial.DecNextVal(3, 4, 0, .5);
+            parallel.DecNextVal(3, 4, 0, .5);
+            serial.Diffuse();
+            parallel.Diffuse();
+            serial.Update();
+            parallel.Update();
+        }
+
+        // Same for the fused step, with uptake and a source row
+        for (ResourceGradient * g : {&serial, &parallel}) {
+            g->SetUptakeKinetics(.01, .05);
+            g->SetUptake(10, 20, 0, true);
+            g->SetUptake(63, 63, 0, true);
+            g->SetSourceRow(0, 9, 1);
+        }
+        for (int step = 0; step < 3; step++) {
+            serial.DecNextVal(3, 4, 0, .5);
+            parallel.DecNextVal(3, 4, 0, .5);
+            serial.Step();
+            parallel.Step();
+        }
+        CHECK(parallel.GetMaxChange() == serial.GetMaxChange());
+
+        for (size_t z = 0; z < 10; z++) {
+            for (size_t y = 0; y < 64; y++) {
+                for (size_t x = 0; x < 64; x++) {
+                    CHECK(parallel.GetVal(x, y, z) == serial.GetVal(x, y, z));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Test temporal blocking", "[oxygen_gradient]") {
+    emp::Random random(3);
+    const size_t X = 40, Y = 90, Z = 8;
+    ResourceGradient start(X, Y, Z);
+    start.SetDiffusionCoefficient(.1);
+    start.SetUptakeKinetics(.01, .05);
+    start.SetSourceRow(0, Z-1, 1);
+    for (size_t z = 0; z < Z; z++) {
+        for (size_t y = 0; y < Y; y++) {
+            for (size_t x = 0; x < X; x++) {
+                start.SetVal(x, y, z, random.GetDouble());
+            }
+        }
+    }
+    emp::vector<bool> consumes(X * Y);
+    for (size_t y = 0; y < Y; y++) {
+        for (size_t x = 0; x < X; x++) {
+            consumes[x + y * X] = random.P(.5);
+            start.SetUptake(x, y, 0, consumes[x + y * X]);
+        }
+    }
+    // Something staged for the first step, like division costs
+    start.DecNextVal(5, 30, 0, .3);
+    start.DecNextVal(6, 89, 0, .2);
+
+    // Step() should match doing each piece by hand, the way
+    // HCAWorld::UpdateOxygen does
+    ResourceGradient by_hand(start);
+    ResourceGradient stepped(start);
+    for (int step = 0; step < 3; step++) {
+        for (size_t y = 0; y < Y; y++) {
+            for (size_t x = 0; x < X; x++) {
+                if (consumes[x + y * X]) {
+                    double multiplier = by_hand.GetVal(x, y, 0);
+                    multiplier /= multiplier + .05;
+                    by_hand.DecNextVal(x, y, 0, .01 * multiplier);
+                }
+            }
+        }
+        by_hand.Diffuse();
+        by_hand.Update();
+        for (size_t x = 0; x < X; x++) {
+            by_hand.SetVal(x, 0, Z-1, 1);
+        }
+        stepped.Step();
+    }
+    for (size_t z = 0; z < Z; z++) {
+        for (size_t y = 0; y < Y; y++) {
+            for (size_t x = 0; x < X; x++) {
+                CHECK(stepped.GetVal(x, y, z) == by_hand.GetVal(x, y, z));
+            }
+        }
+    }
+
+    const size_t steps = 13;
+    ResourceGradient reference(start);
+    for (size_t i = 0; i < steps; i++) {
+        reference.Step();
+    }
+
+    for (size_t threads : {1, 3}) {
+        for (size_t block : {2, 4, 13}) {
+            INFO("threads: " << threads << " block: " << block);
+            ResourceGradient blocked(start);
+            blocked.SetThreads(threads);
+            blocked.StepBlocked(steps, block);
+            for (size_t z = 0; z < Z; z++) {
+                for (size_t y = 0; y < Y; y++) {
+                    for (size_t x = 0; x < X; x++) {
+                        CHECK(blocked.GetVal(x, y, z) == reference.GetVal(x, y, z));
+                        CHECK(blocked.GetNextVal(x, y, z) == 0);
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Test change tracking", "[oxygen_gradient]") {
+    emp::Random random(6);
+    const size_t X = 64, Y = 40, Z = 8;
+    ResourceGradient serial(X, Y, Z);
+    serial.SetDiffusionCoefficient(.1);
+    for (size_t z = 0; z < Z; z++) {
+        for (size_t y = 0; y < Y; y++) {
+            for (size_t x = 0; x < X; x++) {
+                serial.SetVal(x, y, z, random.GetDouble());
+            }
+        }
+    }
+    serial.DecNextVal(3, 4, 0, 5); // Clamped back to 0
+    ResourceGradient parallel(serial);
+    parallel.SetThreads(3);
+    ResourceGradient before(serial);
+
+    serial.Diffuse();
+    serial.Update();
+    parallel.Diffuse();
+    parallel.Update();
+
+    double max_change = 0;
+    double sum_sq = 0;
+    for (size_t z = 0; z < Z; z++) {
+        for (size_t y = 0; y < Y; y++) {
+            for (size_t x = 0; x < X; x++) {
+                const double diff = std::abs(serial.GetVal(x, y, z) - before.GetVal(x, y, z));
+                max_change = std::max(max_change, diff);
+                sum_sq += diff * diff;
+            }
+        }
+    }
+    CHECK(serial.GetMaxChange() == max_change);
+    CHECK(serial.GetL2Change() == Approx(std::sqrt(sum_sq)));
+    CHECK(parallel.GetMaxChange() == max_change);
+    CHECK(parallel.GetL2Change() == Approx(std::sqrt(sum_sq)));
+
+    // Changes die away as the grid evens out
+    for (int i = 0; i < 2000; i++) {
+        serial.Step();
+    }
+    CHECK(serial.GetMaxChange() < max_change * 1e-3);
+
+    // A blocked pass reports its change per step, averaged over the steps in
+    // the pass, so it can be held to the same tolerance as Step()
+    ResourceGradient blocked(before);
+    blocked.StepBlocked(4, 4);
+    double block_max = 0;
+    double block_sum_sq = 0;
+    for (size_t z = 0; z < Z; z++) {
+        for (size_t y = 0; y < Y; y++) {
+            for (size_t x = 0; x < X; x++) {
+                const double diff = std::abs(blocked.GetVal(x, y, z) - before.GetVal(x, y, z));
+                block_max = std::max(block_max, diff);
+                block_sum_sq += diff * diff;
+            }
+        }
+    }
+    CHECK(blocked.GetMaxChange() == Approx(block_max / 4));
+    CHECK(blocked.GetL2Change() == Approx(std::sqrt(block_sum_sq) / 4));
+
+    // Source rows are reset before the change is measured, so a field held
+    // up by a source against uptake settles to no change, with or without
+    // blocking
+    ResourceGradient held(20, 30, 5);
+    held.SetDiffusionCoefficient(.1);
+    held.SetUptakeKinetics(.00075, .01);
+    for (size_t y = 10; y < 20; y++) {
+        for (size_t x = 5; x < 15; x++) {
+            held.SetUptake(x, y, 0, true);
+        }
+    }
+    held.SetSourceRow(0, 0, 1);
+    for (int i = 0; i < 60000; i++) {
+        held.Step();
+    }
+    CHECK(held.GetMaxChange() < 1e-9);
+    ResourceGradient held_blocked(held);
+    held_blocked.StepBlocked(4, 4);
+    CHECK(held_blocked.GetMaxChange() < 1e-9);
+}
+
+TEST_CASE("Test implicit diffusion", "[oxygen_gradient]") {
+    emp::Random random(4);
+
+    // Along each axis on its own, the result should solve the backward
+    // Euler equations (1 + 2r) c_i - r (c_left + c_right) = old_i
+    for (bool toroidal : {false, true}) {
+        for (size_t axis = 0; axis < 3; axis++) {
+            INFO("toroidal: " << toroidal << " axis: " << axis);
+            const size_t n = 17;
+            ResourceGradient line(axis == 0 ? n : 1, axis == 1 ? n : 1, axis == 2 ? n : 1);
+            line.SetDiffusionCoefficient(.1);
+            line.SetToroidal(toroidal);
+            auto at = [&](size_t i) -> double {
+                return line.GetVal(axis == 0 ? i : 0, axis == 1 ? i : 0, axis == 2 ? i : 0);
+            };
+            for (size_t i = 0; i < n; i++) {
+                line.SetVal(axis == 0 ? i : 0, axis == 1 ? i : 0, axis == 2 ? i : 0, random.GetDouble());
+            }
+            emp::vector<double> old(n);
+            for (size_t i = 0; i < n; i++) {
+                old[i] = at(i);
+            }
+
+            const double dt = 50;
+            const double r = .1 * dt;
+            line.StepImplicit(dt);
+            for (size_t i = 0; i < n; i++) {
+                const size_t left = i > 0 ? i - 1 : (toroidal ? n - 1 : i);
+                const size_t right = i + 1 < n ? i + 1 : (toroidal ? 0 : i);
+                CHECK((1 + 2 * r) * at(i) - r * (at(left) + at(right)) == Approx(old[i]));
+            }
+        }
+    }
+
+    const size_t X = 30, Y = 20, Z = 6;
+    ResourceGradient start(X, Y, Z);
+    start.SetDiffusionCoefficient(.1);
+    double total = 0;
+    for (size_t z = 0; z < Z; z++) {
+        for (size_t y = 0; y < Y; y++) {
+            for (size_t x = 0; x < X; x++) {
+                start.SetVal(x, y, z, random.GetDouble());
+                total += start.GetVal(x, y, z);
+            }
+        }
+    }
+
+    // Without sinks or sources, oxygen is conserved however big the step,
+    // and a huge step spreads it out evenly
+    for (bool toroidal : {false, true}) {
+        ResourceGradient implicit(start);
+        implicit.SetToroidal(toroidal);
+        implicit.SetThreads(2);
+        implicit.StepImplicit(1000);
+        double new_total = 0;
+        for (size_t z = 0; z < Z; z++) {
+            for (size_t y = 0; y < Y; y++) {
+                for (size_t x = 0; x < X; x++) {
+                    CHECK(implicit.GetVal(x, y, z) >= 0);
+                    new_total += implicit.GetVal(x, y, z);
+                }
+            }
+        }
+        CHECK(new_total == Approx(total));
+
+        implicit.StepImplicit(1e7);
+        CHECK(implicit.GetVal(0, 0, 0) == Approx(total / (X * Y * Z)));
+        CHECK(implicit.GetVal(X-1, Y-1, Z-1) == Approx(total / (X * Y * Z)));
+    }
+
+    // With uptake and an inflow row, implicit steps should land close to
+    // explicit ones (backward Euler is only first order, so the error
+    // shrinks in proportion to the step size)
+    start.SetUptakeKinetics(.001, .01);
+    start.SetSourceRow(0, Z-1, 1);
+    for (size_t y = 0; y < Y; y++) {
+        for (size_t x = 0; x < X; x++) {
+            start.SetUptake(x, y, 0, random.P(.5));
+        }
+    }
+    start.DecNextVal(3, 3, 0, .2);
+    ResourceGradient explicit_steps(start);
+    ResourceGradient implicit_steps(start);
+    for (int i = 0; i < 500; i++) {
+        explicit_steps.Step();
+    }
+    for (int i = 0; i < 250; i++) {
+        implicit_steps.StepImplicit(2);
+    }
+    for (size_t z = 0; z < Z; z++) {
+        for (size_t y = 0; y < Y; y++) {
+            for (size_t x = 0; x < X; x++) {
+                CHECK(implicit_steps.GetVal(x, y, z) == Approx(explicit_steps.GetVal(x, y, z)).margin(.01));
+                CHECK(implicit_steps.GetNextVal(x, y, z) == 0);
+            }
+        }
+    }
+    for (size_t x = 0; x < X; x++) {
+        CHECK(implicit_steps.GetVal(x, 0, Z-1) == 1);
+    }
+
+    // However big the steps, long runs settle exactly where the steady state
+    // solver does (splitting the step up by axis would shift that)
+    ResourceGradient steady(start);
+    steady.SolveSteadyState(1e-13, 500);
+    for (double dt : {100.0, 1000.0}) {
+        INFO("dt: " << dt);
+        ResourceGradient long_run(start);
+        for (int i = 0; i < 100000 / dt; i++) {
+            long_run.StepImplicit(dt);
+        }
+        double worst = 0;
+        for (size_t z = 0; z < Z; z++) {
+            for (size_t y = 0; y < Y; y++) {
+                for (size_t x = 0; x < X; x++) {
+                    worst = std::max(worst, std::abs(long_run.GetVal(x, y, z) - steady.GetVal(x, y, z)));
+                }
+            }
+        }
+        CHECK(worst < 1e-9);
+    }
+}
+
+TEST_CASE("Test steady state solver", "[oxygen_gradient]") {
+    emp::Random random(5);
+    const size_t X = 40, Y = 50, Z = 9; // Big enough to use both threads
+    ResourceGradient start(X, Y, Z);
+    start.SetDiffusionCoefficient(.1);
+    start.SetUptakeKinetics(.002, .01);
+    start.SetSourceRow(0, Z-1, 1);
+    for (size_t z = 0; z < Z; z++) {
+        for (size_t y = 0; y < Y; y++) {
+            for (size_t x = 0; x < X; x++) {
+                start.SetVal(x, y, z, random.GetDouble());
+            }
+        }
+    }
+    for (size_t y = 0; y < Y; y++) {
+        for (size_t x = 0; x < X; x++) {
+            start.SetUptake(x, y, 0, random.P(.6));
+        }
+    }
+
+    for (bool toroidal : {false, true}) {
+        for (size_t threads : {1, 2}) {
+            INFO("toroidal: " << toroidal << " threads: " << threads);
+            ResourceGradient steady(start);
+            steady.SetToroidal(toroidal);
+            steady.SetThreads(threads);
+            const size_t cycles = steady.SolveSteadyState(1e-12, 100);
+            CHECK(cycles < 100);
+            CHECK(steady.GetSteadyStateResidual() < 1e-12);
+
+            // Another step shouldn't change anything
+            ResourceGradient stepped(steady);
+            stepped.Step();
+            for (size_t z = 0; z < Z; z++) {
+                for (size_t y = 0; y < Y; y++) {
+                    for (size_t x = 0; x < X; x++) {
+                        CHECK(stepped.GetVal(x, y, z) == Approx(steady.GetVal(x, y, z)).margin(1e-11));
+                        CHECK(steady.GetVal(x, y, z) >= 0);
+                    }
+                }
+            }
+            for (size_t x = 0; x < X; x++) {
+                CHECK(steady.GetVal(x, 0, Z-1) == 1);
+            }
+
+            // Starting from the last solution, a small change needs fewer cycles
+            steady.SetUptake(X/2, Y/2, 0, !random.P(.6));
+            CHECK(steady.SolveSteadyState(1e-12, 100) < cycles);
+        }
+    }
+
+    // And it's where plain steps end up eventually
+    ResourceGradient small(6, 5, 3);
+    small.SetDiffusionCoefficient(.1);
+    small.SetUptakeKinetics(.002, .01);
+    small.SetSourceRow(0, 2, 1);
+    small.SetUptake(3, 4, 0, true);
+    small.SetUptake(5, 4, 0, true);
+    ResourceGradient small_steady(small);
+    small_steady.SolveSteadyState(1e-14, 100);
+    for (int i = 0; i < 20000; i++) {
+        small.Step();
+    }
+    for (size_t z = 0; z < 3; z++) {
+        for (size_t y = 0; y < 5; y++) {
+            for (size_t x = 0; x < 6; x++) {
+                CHECK(small_steady.GetVal(x, y, z) == Approx(small.GetVal(x, y, z)).margin(1e-10));
+            }
+        }
+    }
+}
+
+TEST_CASE("Test single precision gradient", "[oxygen_gradient]") {
+    // Every float kernel agrees exactly with the scalar one, and a few hundred
+    // steps stay within float rounding of the double version
+    emp::Random random(3);
+    ResourceGradient exact(37, 20, 4);
+    ResourceGradientT<float> single(37, 20, 4);
+    ResourceGradientT<float, double> mixed(37, 20, 4);
+    for (size_t z = 0; z < 4; z++) {
+        for (size_t y = 0; y < 20; y++) {
+            for (size_t x = 0; x < 37; x++) {
+                const double val = random.GetDouble();
+                exact.SetVal(x, y, z, val);
+                single.SetVal(x, y, z, val);
+                mixed.SetVal(x, y, z, val);
+            }
+        }
+    }
+
+    auto check_kernels = [](auto & r, auto kernels){
+        auto reference = r;
+        reference.SetRowKernel(kernels[0].second);
+        reference.Diffuse();
+        for (auto & kernel : kernels) {
+            INFO("Kernel: " << kernel.first);
+            auto r_kernel = r;
+            r_kernel.SetRowKernel(kernel.second);
+            r_kernel.Diffuse();
+            for (size_t z = 0; z < 4; z++) {
+                for (size_t y = 0; y < 20; y++) {
+                    for (size_t x = 0; x < 37; x++) {
+                        CHECK(r_kernel.GetNextVal(x, y, z) == reference.GetNextVal(x, y, z));
+                    }
+                }
+            }
+        }
+    };
+    check_kernels(single, diffusion_kernels::AvailableKernels<float>());
+    check_kernels(mixed, diffusion_kernels::AvailableKernels<float, double>());
+
+    auto configure = [](auto & r){
+        r.SetDiffusionCoefficient(.1);
+        r.SetUptakeKinetics(.002, .01);
+        r.SetSourceRow(0, 3, 1);
+        r.SetUptake(5, 5, 0, true);
+    };
+    configure(exact);
+    configure(single);
+    configure(mixed);
+    for (int i = 0; i < 300; i++) {
+        exact.Step();
+        single.Step();
+        mixed.Step();
+    }
+    for (size_t z = 0; z < 4; z++) {
+        for (size_t y = 0; y < 20; y++) {
+            for (size_t x = 0; x < 37; x++) {
+                CHECK(single.GetVal(x, y, z) == Approx(exact.GetVal(x, y, z)).margin(1e-5));
+                CHECK(mixed.GetVal(x, y, z) == Approx(exact.GetVal(x, y, z)).margin(1e-6));
+            }
+        }
+    }
+}
+
 TEST_CASE("Test updating gradient", "[oxygen_gradient]") {
     ResourceGradient r(x_len, y_len, 10);
 
@@ -230,6 +919,229 @@ TEST_CASE("Test updating gradient", "[oxygen_gradient]") {
     CHECK(Approx(r.GetVal(5,5,5)) == 0); // Negative numbers should be zeroed out
 }
 
+TEST_CASE("Test staged changes", "[oxygen_gradient]") {
+    // The next grid is never cleared, so stale values from earlier steps
+    // must not leak into later ones
+    ResourceGradient r(6, 5, 3);
+    r.SetDiffusionCoefficient(.1);
+    for (size_t x = 0; x < 6; x++) {
+        r.SetVal(x, 2, 1, 1);
+    }
+    ResourceGradient fresh(r);
+    for (int i = 0; i < 3; i++) {
+        r.Step();
+    }
+    r.Diffuse();
+    r.Update();
+    ResourceGradient reused(r);
+    for (size_t z = 0; z < 3; z++) {
+        for (size_t y = 0; y < 5; y++) {
+            for (size_t x = 0; x < 6; x++) {
+                reused.SetVal(x, y, z, fresh.GetVal(x, y, z));
+            }
+        }
+    }
+
+    // Staged changes are visible before and after diffusing, and changes
+    // made after Diffuse() go straight onto the diffused values
+    fresh.DecNextVal(4, 1, 2, .05);
+    reused.DecNextVal(4, 1, 2, .05);
+    CHECK(reused.GetNextVal(4, 1, 2) == -.05);
+    CHECK(reused.GetNextVal(3, 1, 2) == 0);
+    fresh.Diffuse();
+    reused.Diffuse();
+    fresh.DecNextVal(0, 2, 1, .25);
+    reused.DecNextVal(0, 2, 1, .25);
+    for (size_t z = 0; z < 3; z++) {
+        for (size_t y = 0; y < 5; y++) {
+            for (size_t x = 0; x < 6; x++) {
+                CHECK(reused.GetNextVal(x, y, z) == fresh.GetNextVal(x, y, z));
+            }
+        }
+    }
+    CHECK(fresh.GetNextVal(0, 2, 1) == Approx(1 + .1 * (2 - 6) - .25));
+
+    fresh.Update();
+    reused.Update();
+    fresh.Step();
+    reused.Step();
+    for (size_t z = 0; z < 3; z++) {
+        for (size_t y = 0; y < 5; y++) {
+            for (size_t x = 0; x < 6; x++) {
+                CHECK(reused.GetVal(x, y, z) == fresh.GetVal(x, y, z));
+                CHECK(reused.GetNextVal(x, y, z) == 0);
+            }
+        }
+    }
+}
+
+TEST_CASE("Test finding values below a threshold", "[oxygen_gradient]") {
+    emp::Random random(8);
+    // Layers of 37 * 5 voxels don't fill a whole number of words
+    ResourceGradient grad(37, 5, 3);
+    ResourceGradientT<float> single(37, 5, 3);
+    for (size_t z = 0; z < 3; z++) {
+        for (size_t y = 0; y < 5; y++) {
+            for (size_t x = 0; x < 37; x++) {
+                const double val = random.GetDouble();
+                grad.SetVal(x, y, z, val);
+                single.SetVal(x, y, z, val);
+            }
+        }
+    }
+    grad.SetVal(4, 2, 0, .5); // Exactly at the threshold isn't below it
+
+    emp::vector<uint64_t> below(1, ~(uint64_t)0);
+    emp::vector<uint64_t> single_below;
+    for (size_t z = 0; z < 3; z++) {
+        grad.FindBelow(.5, below, z);
+        single.FindBelow(.5, single_below, z);
+        REQUIRE(below.size() == 3);
+        REQUIRE(single_below.size() == 3);
+        for (size_t pos = 0; pos < 3 * 64; pos++) {
+            const bool in_layer = pos < 37 * 5;
+            const size_t x = pos % 37, y = pos / 37;
+            CHECK((bool)(below[pos / 64] >> (pos % 64) & 1) == (in_layer && grad.GetVal(x, y, z) < .5));
+            CHECK((bool)(single_below[pos / 64] >> (pos % 64) & 1) == (in_layer && single.GetVal(x, y, z) < .5));
+        }
+    }
+}
+
+TEST_CASE("Test object pool", "[full_model]") {
+    // Freed cells are handed out again rather than allocating more memory
+    const size_t live = ObjectPool<Cell>::GetLive();
+    emp::Ptr<Cell> first = emp::NewPtr<Cell>(.5);
+    CHECK(first->stemness == .5);
+    CHECK(ObjectPool<Cell>::GetLive() == live + 1);
+    Cell * where = first.Raw();
+    const size_t capacity = ObjectPool<Cell>::GetCapacity();
+    first.Delete();
+    CHECK(ObjectPool<Cell>::GetLive() == live);
+    emp::Ptr<Cell> second = emp::NewPtr<Cell>();
+    CHECK(second.Raw() == where);
+    CHECK(ObjectPool<Cell>::GetCapacity() == capacity);
+    second.Delete();
+
+    // Slots freed on one thread can be reused on another
+    using SmallPool = ObjectPool<long, 4>;
+    emp::vector<void *> slots;
+    for (int i = 0; i < 8; i++) {
+        slots.push_back(SmallPool::Allocate());
+    }
+    CHECK(SmallPool::GetCapacity() == 8);
+    CHECK(SmallPool::GetFree() == 0);
+    for (void * slot : slots) {
+        SmallPool::Release(slot);
+    }
+    CHECK(SmallPool::GetLive() == 0);
+    std::thread worker([&slots](){
+        for (int i = 0; i < 4; i++) {
+            slots[i] = SmallPool::Allocate();
+        }
+    });
+    worker.join();
+    CHECK(SmallPool::GetCapacity() == 8);
+    CHECK(SmallPool::GetLive() == 4);
+    for (int i = 0; i < 4; i++) {
+        SmallPool::Release(slots[i]);
+    }
+}
+
+TEST_CASE("Test progress reporter", "[full_model]") {
+    std::stringstream out;
+    ProgressReporter silent(0, "{update}", out);
+    silent.Start(10);
+    for (size_t update = 1; update <= 10; update++) {
+        silent.Update(update, 5);
+    }
+    CHECK(out.str() == "");
+
+    ProgressReporter progress(4, "{update}/{total} {pop} {phases} {rate} {unknown}", out);
+    progress.Start(10);
+    for (size_t update = 1; update <= 10; update++) {
+        progress.AddPhaseTime("cells", 1);
+        progress.Update(update, update * 2);
+    }
+    std::string line;
+    std::getline(out, line);
+    CHECK(line.find("4/10 8 cells 4.00s ") == 0);
+    CHECK(line.substr(line.size() - 10) == " {unknown}");
+    std::getline(out, line);
+    CHECK(line.find("8/10 16 cells 4.00s ") == 0);
+    CHECK(!std::getline(out, line));
+
+    // Runs are silent unless asked otherwise
+    MemicConfig quiet;
+    CHECK(quiet.PROGRESS_INTERVAL() == 0);
+    HCAWorld w;
+    CHECK(!w.GetProgress().IsActive());
+}
+
+TEST_CASE("Test lookup table", "[full_model]") {
+    int calls = 0;
+    LookupTable square([&calls](double x){calls++; return x * x;}, -1, 3, 401);
+    CHECK(square.GetNumPoints() == 401);
+    CHECK(calls == 801); // The points, and the middle of each step for the error bound
+    CHECK(square(-1) == 1);
+    CHECK(square(3) == 9);
+    CHECK(square(.5) == Approx(.25).margin(1e-4));
+    CHECK(square(2.2345) == Approx(2.2345 * 2.2345).margin(1e-4));
+    CHECK(calls == 801);
+    // Outside the table, the function itself is used
+    CHECK(square(4) == 16);
+    CHECK(square(-2) == 4);
+    CHECK(calls == 803);
+    // Interpolating x^2 in steps of .01 is off by up to .01^2 / 4
+    CHECK(square.GetMaxError() == Approx(2 * .0001 / 4).epsilon(1e-6));
+    bool within_error = true;
+    for (double x = -1; x <= 3; x += .00037) {
+        within_error &= std::abs(square(x) - x * x) <= square.GetMaxError();
+    }
+    CHECK(within_error);
+
+    // Tabulated surviving fractions should match the formula closely
+    MemicConfig config;
+    config.CELL_DIAMETER(200);
+    config.DIFFUSION_STEPS_PER_TIME_STEP(1);
+    emp::Random r(2);
+    HCAWorld world(r);
+    world.Setup(config);
+    for (double n : {1.0, 5.0, 30.0}) {
+        for (double d : {.5, 2.0, 10.0}) {
+            double worst = 0;
+            for (double c = 0; c <= 1.2; c += .0007) {
+                worst = std::max(worst, std::abs(world.LookupSurvivingFraction(n, d, c) - world.SurvivingFraction(n, d, c)));
+            }
+            CHECK(worst < 1e-6);
+            CHECK(worst <= world.GetDoseTable(n, d).GetMaxError());
+        }
+    }
+    CHECK(world.LookupSurvivingFraction(2, 2, 5) == world.SurvivingFraction(2, 2, 5));
+    CHECK(&world.GetDoseTable(2, 2) == &world.GetDoseTable(2, 2));
+
+    // Survival draws come out as they would against the formula, even when
+    // they land between the table's value and the formula's
+    struct FixedDraw {
+        double draw;
+        int draws = 0;
+        bool P(double p) {
+            draws++;
+            return draw < p;
+        }
+    };
+    const LookupTable & table = world.GetDoseTable(5, 2);
+    for (double c : {.0123, .1, .345678, .9}) {
+        const double exact = world.SurvivingFraction(5, 2, c);
+        const double error = table.GetMaxError();
+        for (double draw : {exact - 2 * error, exact - error / 3, std::nextafter(exact, 0.0), exact,
+                            exact + error / 3, exact + 2 * error, table(c), table(c) - error / 2, table(c) + error / 2}) {
+            FixedDraw random{draw};
+            CHECK(world.DrawSurvival(random, table, 5, 2, c) == (draw < exact));
+            CHECK(random.draws == 1);
+        }
+    }
+}
+
 TEST_CASE("Test HCAWorld", "[full_model]") {
     // Test destructor
     emp::Ptr<HCAWorld> world_ptr;
@@ -256,7 +1168,7 @@ TEST_CASE("Test HCAWorld", "[full_model]") {
             CHECK(!world.IsOccupied(emp::WorldPosition(cell_id, 1)));
             world.Quiesce(cell_id);
             CHECK(age + 1 == world.GetOrg(cell_id).age);
-            CHECK(world.GetOrg(cell_id) == world.GetNextOrg(cell_id));
+            CHECK(!world.IsOccupied(emp::WorldPosition(cell_id, 1))); // Not copied
 
             Cell& cell_org = world.GetOrg(cell_id);
             int clade_before = cell_org.clade;            
@@ -284,10 +1196,556 @@ TEST_CASE("Test HCAWorld", "[full_model]") {
     world.RunStep();
     std::cout << world.IsOccupied(0) << " " << world.GetOrg(0).hif1alpha << std::endl;
     CHECK((!world.IsOccupied(0) || Approx(world.GetOrg(0).hif1alpha) == 1));
+    world.UpdateHypoxia();
+    CHECK(world.IsHypoxic(0) == (world.GetOxygen().GetVal(0, 0) < config.OXYGEN_THRESHOLD()));
+    world.GetOxygen().SetVal(1, 0, 0, config.OXYGEN_THRESHOLD() / 2);
+    world.UpdateHypoxia();
+    CHECK(world.IsHypoxic(1));
+
+    // Quiescent cells carry on into the next generation as the same object,
+    // unless they've reached the age limit
+    world.Clear();
+    world.InjectAt(Cell(), 5);
+    world.InjectAt(Cell(), 6);
+    world.GetOrg(6).age = config.AGE_LIMIT() - 1;
+    Cell * survivor = &world.GetOrg(5);
+    world.Quiesce(5);
+    world.Quiesce(6);
+    world.Update();
+    CHECK(world.IsOccupied(5));
+    CHECK(&world.GetOrg(5) == survivor);
+    CHECK(world.GetOrg(5).age == 1);
+    CHECK(!world.IsOccupied(6));
+    CHECK(world.GetNumOrgs() == 1);
+    CHECK(world.HasCell(5));
+    CHECK(!world.HasCell(6));
 
     world.Reset(config);
     config.OXYGEN_DIFFUSION_COEFFICIENT(.09);
     world.InitConfigs(config);
     CHECK(world.GetOxygen().GetDiffusionCoefficient() == Approx(.09));
     world.Run();
-}
\ No newline at end of file
+}
+
+// Systematics that also count the organisms added to each clade and
+// removed overall, over the whole run (like a taxon's total organisms)
+class CountingSystematics : public emp::Systematics<Cell, int> {
+    public:
+    std::map<int, int> added;
+    int removed = 0;
+
+    CountingSystematics() : emp::Systematics<Cell, int>([](const Cell & c){return c.clade;}) {;}
+
+    void AddOrg(Cell & org, emp::WorldPosition pos, int update) override {
+        added[org.clade]++;
+        emp::Systematics<Cell, int>::AddOrg(org, pos, update);
+    }
+
+    bool RemoveOrg(emp::WorldPosition pos) override {
+        removed++;
+        return emp::Systematics<Cell, int>::RemoveOrg(pos);
+    }
+};
+
+TEST_CASE("Test systematics of quiescent cells", "[full_model]") {
+    MemicConfig config;
+    config.CELL_DIAMETER(200);
+    config.INIT_POP_SIZE(0);
+    config.MITOSIS_PROB(0);
+    config.DIFFUSION_STEPS_PER_TIME_STEP(1);
+    emp::Random r(5);
+    HCAWorld world(r);
+    world.Setup(config);
+    emp::Ptr<CountingSystematics> counting = emp::NewPtr<CountingSystematics>();
+    emp::Ptr<emp::Systematics<Cell, int> > counted = counting;
+    world.AddSystematics(counted);
+    world.SetSynchronousSystematics(true);
+
+    Cell first_clade;
+    first_clade.clade = 1;
+    Cell second_clade;
+    second_clade.clade = 2;
+    for (size_t cell_id : {10, 50, 90}) {
+        world.InjectAt(first_clade, cell_id);
+    }
+    for (size_t cell_id : {130, 170}) {
+        world.InjectAt(second_clade, cell_id);
+    }
+
+    // Every update, each quiescent cell is counted as a new member of its
+    // clade and the old one as removed, as when quiescent cells were copied
+    // into the next generation
+    const int steps = 4;
+    for (int step = 0; step < steps; step++) {
+        world.RunStep();
+    }
+    CHECK(world.GetNumOrgs() == 5);
+    CHECK(counting->added[1] == 3 * (steps + 1));
+    CHECK(counting->added[2] == 2 * (steps + 1));
+    CHECK(counting->removed == 5 * steps);
+}
+
+TEST_CASE("Test stopping diffusion early", "[full_model]") {
+    // With a source row holding oxygen up against the cells' uptake, the
+    // field converges, and diffusion then stops well short of its steps
+    MemicConfig settling;
+    settling.CELL_DIAMETER(200);
+    settling.DIFFUSION_STEPS_PER_TIME_STEP(1000);
+    settling.DIFFUSION_TOLERANCE(1e-5);
+    emp::Random r(3);
+    HCAWorld w(r);
+    w.Setup(settling);
+    w.GetOxygen().SetSourceRow(0, 0, 1);
+    bool settled = false;
+    for (int i = 0; i < 100 && !settled; i++) {
+        w.DiffuseOxygen();
+        settled = w.OxygenSettled();
+    }
+    CHECK(settled);
+    CHECK(w.GetOxygen().GetMaxChange() < 1e-5);
+}
+
+TEST_CASE("Test config checks", "[full_model]") {
+    // Settings the model can't run with are rejected before anything starts
+    auto rejects = [](std::function<void(MemicConfig &)> change) {
+        MemicConfig config;
+        config.CELL_DIAMETER(200);
+        change(config);
+        HCAWorld world;
+        bool rejected = false;
+        try {
+            world.InitConfigs(config);
+        } catch (const std::invalid_argument &) {
+            rejected = true;
+        }
+        return rejected;
+    };
+    CHECK(!rejects([](MemicConfig &){}));
+    CHECK(rejects([](MemicConfig & c){c.DIFFUSION_THREADS(-1);}));
+    CHECK(!rejects([](MemicConfig & c){c.DIFFUSION_THREADS(0);}));
+    CHECK(rejects([](MemicConfig & c){c.AGENT_THREADS(-4);}));
+    CHECK(!rejects([](MemicConfig & c){c.AGENT_THREADS(0);}));
+    CHECK(rejects([](MemicConfig & c){c.RANDOM_STREAMS("per-cell");}));
+    CHECK(!rejects([](MemicConfig & c){c.RANDOM_STREAMS("per_cell");}));
+    CHECK(rejects([](MemicConfig & c){c.OXYGEN_SOLVER("implict");}));
+    CHECK(!rejects([](MemicConfig & c){c.OXYGEN_SOLVER("implicit");}));
+    CHECK(!rejects([](MemicConfig & c){c.OXYGEN_SOLVER("explicit");}));
+    CHECK(!rejects([](MemicConfig & c){c.OXYGEN_SOLVER("steady");}));
+    CHECK(rejects([](MemicConfig & c){c.OXYGEN_SOLVER("Steady");}));
+    CHECK(rejects([](MemicConfig & c){c.OXYGEN_SOLVER("steady"); c.STEADY_STATE_MAX_CYCLES(0);}));
+    CHECK(rejects([](MemicConfig & c){c.OXYGEN_SOLVER("steady"); c.STEADY_STATE_TOLERANCE(-1);}));
+    CHECK(!rejects([](MemicConfig & c){c.OXYGEN_SOLVER("explicit"); c.STEADY_STATE_MAX_CYCLES(0);}));
+}
+
+TEST_CASE("Test occupancy tracking", "[full_model]") {
+    MemicConfig small;
+    small.CELL_DIAMETER(200);
+    small.DIFFUSION_STEPS_PER_TIME_STEP(5);
+    small.SEED(3);
+    emp::Random r(3);
+    HCAWorld w(r);
+    w.Setup(small);
+
+    // The bitmap and the dense list should always agree with the population
+    const size_t grid_size = w.GetWorldX() * w.GetWorldY();
+    auto check_occupancy = [&w, grid_size]() {
+        std::set<size_t> listed(w.GetOccupiedCells().begin(), w.GetOccupiedCells().end());
+        CHECK(listed.size() == w.GetOccupiedCells().size());
+        CHECK(listed.size() == w.GetNumOrgs());
+        size_t next = w.NextOccupied(0);
+        for (size_t cell_id = 0; cell_id < grid_size; cell_id++) {
+            CHECK(w.HasCell(cell_id) == w.IsOccupied(cell_id));
+            CHECK(listed.count(cell_id) == (size_t)w.IsOccupied(cell_id));
+            if (w.IsOccupied(cell_id)) {
+                CHECK(next == cell_id);
+                next = w.NextOccupied(cell_id + 1);
+            }
+        }
+        CHECK(next == grid_size);
+    };
+
+    check_occupancy();
+    for (int step = 0; step < 10; step++) {
+        w.RunStep();
+        check_occupancy();
+    }
+    w.ApplyRadiation(1, 10);
+    w.RunStep();
+    check_occupancy();
+
+    // Frontier bits should match a cell-by-cell check of each neighborhood,
+    // including on grids wider than one word
+    for (double diameter : {200.0, 40.0, 20.0}) {
+        MemicConfig wide;
+        wide.CELL_DIAMETER(diameter);
+        wide.INIT_POP_SIZE(0);
+        emp::Random wide_random(8);
+        HCAWorld frontier_world(wide_random);
+        frontier_world.Setup(wide);
+        const int wx = (int)frontier_world.GetWorldX();
+        const int wy = (int)frontier_world.GetWorldY();
+        for (int cell_id = 0; cell_id < wx * wy; cell_id++) {
+            if (wide_random.P(.9)) {
+                frontier_world.InjectAt(Cell(), (size_t)cell_id);
+            }
+        }
+        frontier_world.UpdateFrontier();
+        bool all_match = true;
+        for (int y = 0; y < wy; y++) {
+            for (int x = 0; x < wx; x++) {
+                bool open = false;
+                for (int ny = std::max(0, y - 1); ny < std::min(wy, y + 2); ny++) {
+                    for (int nx = std::max(0, x - 1); nx < std::min(wx, x + 2); nx++) {
+                        open |= !frontier_world.IsOccupied((size_t)(ny * wx + nx));
+                    }
+                }
+                const size_t pos = (size_t)(y * wx + x);
+                all_match &= frontier_world.IsFrontier(pos) == (frontier_world.IsOccupied(pos) && open);
+            }
+        }
+        CHECK(all_match);
+    }
+
+    w.Clear();
+    CHECK(w.GetOccupiedCells().size() == 0);
+    CHECK(w.NextOccupied(0) == grid_size);
+
+    // A cell surrounded on all sides has nowhere to divide into; one on the
+    // edge of the grid only looks at the neighbors it has
+    const size_t width = w.GetWorldX();
+    for (size_t y = 0; y < 3; y++) {
+        for (size_t x = 1; x < 4; x++) {
+            w.InjectAt(Cell(), y * width + x);
+        }
+    }
+    check_occupancy();
+    CHECK(w.CanDivide(width + 2) == -1);
+    CHECK(w.CanDivide(1) != -1);
+    w.InjectAt(Cell(), 0);
+    w.InjectAt(Cell(), width);
+    CHECK(w.CanDivide(1) == -1);
+    w.RemoveOrgAt(2 * width + 2);
+    CHECK(w.CanDivide(width + 2) == (int)(2 * width + 2));
+
+    // Every open spot should be picked, and nothing else
+    w.RemoveOrgAt(2);
+    std::set<int> picked;
+    for (int i = 0; i < 100; i++) {
+        picked.insert(w.CanDivide(width + 2));
+    }
+    CHECK(picked == std::set<int>({2, (int)(2 * width + 2)}));
+    check_occupancy();
+}
+
+TEST_CASE("Test 3D cell population", "[full_model]") {
+    MemicConfig solid;
+    solid.CELL_DIAMETER(200);
+    solid.CELL_DIMENSIONS(3);
+    solid.INIT_POP_SIZE(0);
+    solid.DIFFUSION_STEPS_PER_TIME_STEP(5);
+    emp::Random r(9);
+    HCAWorld w(r);
+    w.Setup(solid);
+    const size_t wx = w.GetWorldX(), wy = w.GetWorldY(), wz = w.GetWorldZ();
+    CHECK(w.GetCellLayers() == wz);
+    CHECK(w.GetNumPositions() == wx * wy * wz);
+    CHECK(w.GetSize() == wx * wy * wz);
+    auto pos_of = [wx, wy](size_t x, size_t y, size_t z) {return (z * wy + y) * wx + x;};
+    CHECK(w.GetPosX(pos_of(3, 4, 5)) == 3);
+    CHECK(w.GetPosY(pos_of(3, 4, 5)) == 4);
+    CHECK(w.GetPosZ(pos_of(3, 4, 5)) == 5);
+
+    // emp's neighbor functions see layers, not one tall grid: spots in the
+    // layers above and below are neighbors, and rows wrap within a layer
+    CHECK(w.IsNeighbor(pos_of(3, 4, 5), pos_of(4, 5, 6)));
+    CHECK(w.IsNeighbor(pos_of(3, 4, 5), pos_of(2, 3, 4)));
+    CHECK(w.IsNeighbor(pos_of(3, wy - 1, 5), pos_of(3, 0, 5)));
+    CHECK(!w.IsNeighbor(pos_of(3, 4, 5), pos_of(3, 4, 7)));
+    CHECK(!w.IsNeighbor(pos_of(3, 4, 5), pos_of(3, 6, 5)));
+    std::set<size_t> neighbors;
+    for (int i = 0; i < 1000; i++) {
+        const emp::WorldPosition next = w.GetRandomNeighborPos(pos_of(0, wy - 1, 5));
+        CHECK(w.IsNeighbor(next, pos_of(0, wy - 1, 5)));
+        neighbors.insert(next.GetIndex());
+    }
+    CHECK(neighbors.size() == 27);
+
+    // A cell in the middle of a full 3x3x3 block has nowhere to go; any spot
+    // opening up in the layers above or below is found
+    for (size_t z = 2; z < 5; z++) {
+        for (size_t y = 4; y < 7; y++) {
+            for (size_t x = 4; x < 7; x++) {
+                w.InjectAt(Cell(), pos_of(x, y, z));
+            }
+        }
+    }
+    CHECK(w.CanDivide(pos_of(5, 5, 3)) == -1);
+    w.RemoveOrgAt(pos_of(4, 6, 2));
+    CHECK(w.CanDivide(pos_of(5, 5, 3)) == (int)pos_of(4, 6, 2));
+    w.RemoveOrgAt(pos_of(6, 4, 4));
+    std::set<int> picked;
+    for (int i = 0; i < 100; i++) {
+        picked.insert(w.CanDivide(pos_of(5, 5, 3)));
+    }
+    CHECK(picked == std::set<int>({(int)pos_of(4, 6, 2), (int)pos_of(6, 4, 4)}));
+
+    // Cells on the bottom layer only look up
+    w.Clear();
+    for (size_t z = 0; z < 2; z++) {
+        for (size_t y = 0; y < 2; y++) {
+            for (size_t x = 0; x < 2; x++) {
+                w.InjectAt(Cell(), pos_of(x, y, z));
+            }
+        }
+    }
+    CHECK(w.CanDivide(pos_of(0, 0, 0)) == -1);
+
+    // Frontier bits should match a cell-by-cell check of each 27-cell
+    // neighborhood
+    w.Clear();
+    for (size_t pos = 0; pos < w.GetNumPositions(); pos++) {
+        if (r.P(.9)) {
+            w.InjectAt(Cell(), pos);
+        }
+    }
+    w.UpdateFrontier();
+    bool all_match = true;
+    for (int z = 0; z < (int)wz; z++) {
+        for (int y = 0; y < (int)wy; y++) {
+            for (int x = 0; x < (int)wx; x++) {
+                bool open = false;
+                for (int nz = std::max(0, z - 1); nz < std::min((int)wz, z + 2); nz++) {
+                    for (int ny = std::max(0, y - 1); ny < std::min((int)wy, y + 2); ny++) {
+                        for (int nx = std::max(0, x - 1); nx < std::min((int)wx, x + 2); nx++) {
+                            open |= !w.IsOccupied(pos_of(nx, ny, nz));
+                        }
+                    }
+                }
+                const size_t pos = pos_of(x, y, z);
+                all_match &= w.IsFrontier(pos) == (w.IsOccupied(pos) && open);
+            }
+        }
+    }
+    CHECK(all_match);
+
+    // Hypoxia is read from each cell's own layer
+    w.GetOxygen().SetVal(2, 3, 4, 0);
+    w.UpdateHypoxia();
+    CHECK(w.IsHypoxic(pos_of(2, 3, 4)));
+    CHECK(!w.IsHypoxic(pos_of(2, 3, 0)));
+
+    // A single cell grows into the layers around it, consuming oxygen
+    // where it is
+    w.Clear();
+    w.InitOxygen();
+    const size_t start = pos_of(wx / 2, wy / 2, wz / 2);
+    w.InjectAt(Cell(), start);
+    w.UpdateOxygenUptake();
+    w.BasalOxygenConsumption();
+    CHECK(w.GetOxygen().GetNextVal(wx / 2, wy / 2, wz / 2) < 0);
+    CHECK(w.GetOxygen().GetNextVal(wx / 2, wy / 2, 0) == 0);
+    for (int step = 0; step < 6; step++) {
+        w.RunStep();
+    }
+    std::set<size_t> layers;
+    for (size_t cell_id : w.GetOccupiedCells()) {
+        CHECK(w.IsOccupied(cell_id));
+        layers.insert(w.GetPosZ(cell_id));
+    }
+    CHECK(w.GetOccupiedCells().size() == w.GetNumOrgs());
+    CHECK(layers.size() > 1);
+
+    // The oxygen file has a grid for every layer, a blank line before each
+    // one after the first
+    w.PrintOxygenGrid("oxygen_3d_test.csv");
+    std::ifstream oxygen_file("oxygen_3d_test.csv");
+    emp::vector<std::string> lines;
+    for (std::string line; std::getline(oxygen_file, line);) {
+        lines.push_back(line);
+    }
+    oxygen_file.close();
+    std::remove("oxygen_3d_test.csv");
+    REQUIRE(lines.size() == wz * wy + wz - 1);
+    for (size_t z = 1; z < wz; z++) {
+        CHECK(lines[z * (wy + 1) - 1].empty());
+    }
+    const size_t mid_line = (wz / 2) * (wy + 1) + wy / 2;
+    CHECK(lines[mid_line].substr(0, lines[mid_line].find(',')) == emp::to_string(w.GetOxygen().GetVal(0, wy / 2, wz / 2)));
+
+    // Bands of rows run through every layer, so threads still don't change
+    // the run
+    solid.INIT_POP_SIZE(200);
+    solid.RANDOM_STREAMS("per_cell");
+    solid.SEED(2);
+    emp::Random serial_random(2);
+    emp::Random parallel_random(2);
+    HCAWorld serial(serial_random);
+    HCAWorld parallel(parallel_random);
+    serial.Setup(solid);
+    solid.AGENT_THREADS(3);
+    parallel.Setup(solid);
+    for (int step = 0; step < 8; step++) {
+        serial.RunStep();
+        parallel.RunStep();
+    }
+    CHECK(serial.GetNumOrgs() == parallel.GetNumOrgs());
+    for (size_t cell_id = 0; cell_id < serial.GetSize(); cell_id++) {
+        REQUIRE(serial.IsOccupied(cell_id) == parallel.IsOccupied(cell_id));
+        if (serial.IsOccupied(cell_id)) {
+            CHECK(serial.GetOrg(cell_id).clade == parallel.GetOrg(cell_id).clade);
+        }
+    }
+}
+
+TEST_CASE("Test parallel agent update", "[full_model]") {
+    // With more than one agent thread, bands of rows draw from their own
+    // random streams, so any number of threads gives the same run
+    MemicConfig parallel;
+    parallel.CELL_DIAMETER(100);
+    parallel.DIFFUSION_STEPS_PER_TIME_STEP(5);
+    parallel.MITOSIS_PROB(.8);
+    parallel.SEED(4);
+    emp::Random two_random(4);
+    emp::Random three_random(4);
+    HCAWorld two(two_random);
+    HCAWorld three(three_random);
+    parallel.AGENT_THREADS(2);
+    two.Setup(parallel);
+    parallel.AGENT_THREADS(3);
+    three.Setup(parallel);
+
+    for (int step = 0; step < 15; step++) {
+        two.RunStep();
+        three.RunStep();
+        CHECK(two.GetNumOrgs() == three.GetNumOrgs());
+    }
+    CHECK(two.GetNumOrgs() > 500);
+    for (size_t cell_id = 0; cell_id < two.GetSize(); cell_id++) {
+        REQUIRE(two.IsOccupied(cell_id) == three.IsOccupied(cell_id));
+        if (two.IsOccupied(cell_id)) {
+            CHECK(two.GetOrg(cell_id).age == three.GetOrg(cell_id).age);
+            CHECK(two.GetOrg(cell_id).clade == three.GetOrg(cell_id).clade);
+            CHECK(two.GetOrg(cell_id).hif1alpha == three.GetOrg(cell_id).hif1alpha);
+        }
+    }
+}
+
+TEST_CASE("Test per-cell random streams", "[full_model]") {
+    // Philox4x32-10 known answers, from the Random123 test vectors
+    const uint32_t counters[3][4] = {{0, 0, 0, 0}, {~0u, ~0u, ~0u, ~0u}, {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}};
+    const uint32_t keys[3][2] = {{0, 0}, {~0u, ~0u}, {0xa4093822, 0x299f31d0}};
+    const uint32_t answers[3][4] = {{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+                                    {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+                                    {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}};
+    for (int i = 0; i < 3; i++) {
+        uint32_t out[4];
+        CounterRandom::Philox(counters[i], keys[i], out);
+        for (int word = 0; word < 4; word++) {
+            CHECK(out[word] == answers[i][word]);
+        }
+    }
+
+    // Same stream ids, same numbers; different ids, different numbers
+    CounterRandom a(7, 1, 2, 3);
+    CounterRandom b(7, 1, 2, 3);
+    CounterRandom c(7, 1, 2, 4);
+    double total = 0;
+    for (int i = 0; i < 1000; i++) {
+        const double value = a.GetDouble();
+        CHECK(value == b.GetDouble());
+        CHECK(value != c.GetDouble());
+        CHECK(value >= 0);
+        CHECK(value < 1);
+        total += value;
+    }
+    CHECK(total / 1000 == Approx(.5).margin(.05));
+
+    // Coin flips and choices take one 32-bit word each, four to a block
+    CounterRandom flips(7, 4, 5, 6);
+    int heads = 0;
+    int counts[3] = {0, 0, 0};
+    for (int i = 0; i < 30000; i++) {
+        heads += flips.P(.3);
+        CHECK(!flips.P(0));
+        CHECK(flips.P(1));
+        counts[flips.GetUInt(0, 3)]++;
+    }
+    CHECK(heads / 30000.0 == Approx(.3).margin(.01));
+    for (int count : counts) {
+        CHECK(count / 30000.0 == Approx(1 / 3.0).margin(.01));
+    }
+    CounterRandom words(7, 4, 5, 6);
+    for (int i = 0; i < 4; i++) {
+        words.P(.5);
+    }
+    const uint32_t second_counter[4] = {4, 5, 6, 1};
+    const uint32_t key[2] = {7, 0};
+    uint32_t second_block[4];
+    CounterRandom::Philox(second_counter, key, second_block);
+    CHECK(words.GetUInt() == second_block[0]);
+
+    // With per-cell streams, the serial and parallel updates are the same run
+    MemicConfig streams;
+    streams.CELL_DIAMETER(100);
+    streams.DIFFUSION_STEPS_PER_TIME_STEP(5);
+    streams.MITOSIS_PROB(.8);
+    streams.SEED(9);
+    streams.RANDOM_STREAMS("per_cell");
+    emp::Random serial_random(9);
+    emp::Random parallel_random(9);
+    HCAWorld serial(serial_random);
+    HCAWorld parallel(parallel_random);
+    serial.Setup(streams);
+    streams.AGENT_THREADS(3);
+    parallel.Setup(streams);
+
+    for (int step = 0; step < 15; step++) {
+        if (step == 8) {
+            serial.ApplyRadiation(1, 2);
+            parallel.ApplyRadiation(1, 2);
+        }
+        serial.RunStep();
+        parallel.RunStep();
+        CHECK(serial.GetNumOrgs() == parallel.GetNumOrgs());
+    }
+    CHECK(serial.GetNumOrgs() > 500);
+    for (size_t cell_id = 0; cell_id < serial.GetSize(); cell_id++) {
+        REQUIRE(serial.IsOccupied(cell_id) == parallel.IsOccupied(cell_id));
+        if (serial.IsOccupied(cell_id)) {
+            CHECK(serial.GetOrg(cell_id).age == parallel.GetOrg(cell_id).age);
+            CHECK(serial.GetOrg(cell_id).clade == parallel.GetOrg(cell_id).clade);
+        }
+    }
+}
+
+TEST_CASE("Test single precision model", "[full_model]") {
+    // Storing oxygen as floats shouldn't change what the model does: same
+    // population trajectory and nearly the same oxygen field
+    MemicConfig small;
+    small.CELL_DIAMETER(200);
+    small.DIFFUSION_STEPS_PER_TIME_STEP(20);
+    small.SEED(11);
+    emp::Random exact_random(11);
+    emp::Random single_random(11);
+    emp::Random mixed_random(11);
+    HCAWorld exact(exact_random);
+    HCAWorldT<ResourceGradientT<float> > single(single_random);
+    HCAWorldT<ResourceGradientT<float, double> > mixed(mixed_random);
+    exact.Setup(small);
+    single.Setup(small);
+    mixed.Setup(small);
+
+    for (int step = 0; step < 30; step++) {
+        exact.RunStep();
+        single.RunStep();
+        mixed.RunStep();
+        CHECK(single.GetNumOrgs() == Approx(exact.GetNumOrgs()).epsilon(.05));
+        CHECK(mixed.GetNumOrgs() == Approx(exact.GetNumOrgs()).epsilon(.05));
+    }
+    for (size_t y = 0; y < exact.GetWorldY(); y++) {
+        for (size_t x = 0; x < exact.GetWorldX(); x++) {
+            CHECK(single.GetOxygen().GetVal(x, y) == Approx(exact.GetOxygen().GetVal(x, y)).margin(1e-4));
+            CHECK(mixed.GetOxygen().GetVal(x, y) == Approx(exact.GetOxygen().GetVal(x, y)).margin(1e-4));
+        }
+    }
+}